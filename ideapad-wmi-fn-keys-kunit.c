@@ -0,0 +1,780 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * ideapad-wmi-fn-keys-kunit.c - KUnit tests and microbenchmarks for the
+ * Ideapad WMI fn keys scancode path
+ *
+ * Built by "make kunit". The driver is included to reach its static functions
+ * and reports into a registered input device with a dedicated handler. It
+ * neither exports symbols nor defines tracepoints, so it loads alongside the
+ * driver module.
+ */
+
+#define IDEAPAD_WMI_KUNIT
+/* Must precede the first <linux/tracepoint.h> to stub the tracepoints out */
+#define NOTRACE
+#include "ideapad-wmi-fn-keys.c"
+
+#include <kunit/test.h>
+
+/* Events per microbenchmark run */
+#define IDEAPAD_WMI_BENCH_EVENTS	100000
+
+struct ideapad_wmi_test {
+	struct wmi_device *wdev;
+	struct ideapad_wmi_private *priv;
+	struct input_handler handler;
+	bool handler_registered;
+	unsigned int presses;
+	unsigned int releases;
+	unsigned int syncs;
+	unsigned int last_keycode;
+};
+
+static void ideapad_wmi_test_event(struct input_handle *handle,
+				   unsigned int type, unsigned int code,
+				   int value)
+{
+	struct ideapad_wmi_test *t = handle->private;
+
+	switch (type) {
+	case EV_KEY:
+		if (value) {
+			t->presses++;
+			t->last_keycode = code;
+		} else {
+			t->releases++;
+		}
+		break;
+	case EV_SYN:
+		t->syncs++;
+		break;
+	}
+}
+
+static bool ideapad_wmi_test_match(struct input_handler *handler,
+				   struct input_dev *dev)
+{
+	struct ideapad_wmi_test *t = handler->private;
+
+	return dev->dev.parent == &t->wdev->dev;
+}
+
+static int ideapad_wmi_test_connect(struct input_handler *handler,
+				    struct input_dev *dev,
+				    const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int err;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "ideapad-wmi-kunit";
+	handle->private = handler->private;
+
+	err = input_register_handle(handle);
+	if (err)
+		goto err_free_handle;
+
+	err = input_open_device(handle);
+	if (err)
+		goto err_unregister_handle;
+
+	return 0;
+
+err_unregister_handle:
+	input_unregister_handle(handle);
+err_free_handle:
+	kfree(handle);
+	return err;
+}
+
+static void ideapad_wmi_test_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id ideapad_wmi_test_ids[] = {
+	{ .driver_info = 1 },	/* Matches all devices, filtered by match() */
+	{ }
+};
+
+static void ideapad_wmi_test_release(struct device *dev)
+{
+	kfree(container_of(dev, struct wmi_device, dev));
+}
+
+/* The input device needs a registered parent to hang off */
+static struct wmi_device *ideapad_wmi_test_add_device(struct kunit *test,
+						      const char *name)
+{
+	struct wmi_device *wdev;
+	int err;
+
+	wdev = kzalloc(sizeof(*wdev), GFP_KERNEL);
+	if (!wdev)
+		return NULL;
+
+	device_initialize(&wdev->dev);
+	wdev->dev.release = ideapad_wmi_test_release;
+
+	err = dev_set_name(&wdev->dev, "%s", name);
+	if (!err)
+		err = device_add(&wdev->dev);
+	if (err) {
+		put_device(&wdev->dev);
+		KUNIT_FAIL(test, "Could not add the WMI device: %d", err);
+		return NULL;
+	}
+
+	return wdev;
+}
+
+/* Mirrors ideapad_wmi_shared_create() without the debugfs files */
+static int ideapad_wmi_test_init(struct kunit *test)
+{
+	struct ideapad_wmi_instance *instance;
+	struct ideapad_wmi_private *priv;
+	struct ideapad_wmi_test *t;
+	struct wmi_device *wdev;
+	int err;
+
+	t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, t);
+	test->priv = t;
+
+	priv = kunit_kzalloc(test, sizeof(*priv), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv);
+	t->priv = priv;
+
+	priv->arena = kunit_kzalloc(test, sizeof(*priv->arena), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, priv->arena);
+	priv->records = priv->arena->records;
+	priv->macro_arena = priv->arena->macros;
+
+	priv->stats = alloc_percpu(struct ideapad_wmi_stats);
+	KUNIT_ASSERT_NOT_NULL(test, priv->stats);
+
+	priv->latency = alloc_percpu(struct ideapad_wmi_latency_stats);
+	KUNIT_ASSERT_NOT_NULL(test, priv->latency);
+
+	wdev = ideapad_wmi_test_add_device(test, "ideapad-wmi-kunit");
+	if (!wdev)
+		return -ENODEV;
+	t->wdev = wdev;
+
+	dev_set_drvdata(&wdev->dev, priv);
+	priv->wmi_device = wdev;
+
+	instance = kunit_kzalloc(test, sizeof(*instance), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, instance);
+	instance->wdev = wdev;
+	INIT_LIST_HEAD(&priv->instances);
+	list_add_tail(&instance->node, &priv->instances);
+	mutex_init(&priv->instances_lock);
+	spin_lock_init(&priv->keymap_lock);
+	spin_lock_init(&priv->pending_lock);
+	spin_lock_init(&priv->delivery_lock);
+	mutex_init(&priv->inject_lock);
+	mutex_init(&priv->macro_lock);
+	INIT_KFIFO(priv->pending);
+	INIT_KFIFO(priv->delivery);
+	INIT_WORK(&priv->input_work, ideapad_wmi_input_work);
+	INIT_WORK(&priv->delivery_work, ideapad_wmi_delivery_work);
+	INIT_WORK(&priv->fn_lock_work, ideapad_wmi_fn_lock_work);
+	INIT_DELAYED_WORK(&priv->log_work, ideapad_wmi_log_work);
+	hrtimer_setup(&priv->long_press_timer, ideapad_wmi_long_press_expired,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	ratelimit_state_init(&priv->unknown.summary_rs,
+			     IDEAPAD_WMI_UNKNOWN_SUMMARY_INTERVAL, 1);
+	ratelimit_set_flags(&priv->unknown.summary_rs, RATELIMIT_MSG_ON_RELEASE);
+
+	/* Test against the built-in keymap only */
+	keymap_firmware = "";
+	err = ideapad_wmi_keymap_init(priv);
+	KUNIT_ASSERT_EQ(test, err, 0);
+
+	t->handler.event = ideapad_wmi_test_event;
+	t->handler.match = ideapad_wmi_test_match;
+	t->handler.connect = ideapad_wmi_test_connect;
+	t->handler.disconnect = ideapad_wmi_test_disconnect;
+	t->handler.name = "ideapad-wmi-kunit";
+	t->handler.id_table = ideapad_wmi_test_ids;
+	t->handler.private = t;
+
+	err = input_register_handler(&t->handler);
+	KUNIT_ASSERT_EQ(test, err, 0);
+	t->handler_registered = true;
+
+	err = ideapad_wmi_input_init(priv);
+	KUNIT_ASSERT_EQ(test, err, 0);
+	ideapad_wmi_flush_pending(priv);
+
+	return 0;
+}
+
+static void ideapad_wmi_test_exit(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct ideapad_wmi_private *priv;
+
+	/* Also called after a failed init */
+	if (!t || !t->priv)
+		return;
+
+	priv = t->priv;
+	if (priv->input_dev)
+		ideapad_wmi_input_exit(priv);
+	if (priv->delivery_wq)
+		destroy_workqueue(priv->delivery_wq);
+	hrtimer_cancel(&priv->long_press_timer);
+	cancel_work_sync(&priv->fn_lock_work);
+	cancel_delayed_work_sync(&priv->log_work);
+	if (t->handler_registered)
+		input_unregister_handler(&t->handler);
+	if (rcu_access_pointer(priv->keymap))
+		ideapad_wmi_keymap_exit(priv);
+	if (t->wdev)
+		device_unregister(&t->wdev->dev);
+	free_percpu(priv->latency);
+	free_percpu(priv->stats);
+}
+
+static void ideapad_wmi_test_report(struct ideapad_wmi_test *t, u32 scancode)
+{
+	struct ideapad_wmi_frame frame = { .input_dev = t->priv->input_dev };
+
+	rcu_read_lock();
+	ideapad_wmi_input_report(t->priv, &frame, scancode);
+	ideapad_wmi_frame_flush(&frame);
+	rcu_read_unlock();
+}
+
+static void ideapad_wmi_test_known(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+
+	ideapad_wmi_test_report(t, 0x01);
+
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, t->releases, 1);
+	KUNIT_EXPECT_EQ(test, t->syncs, 2);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_PROG1);
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, key_events[0x01]), 1);
+}
+
+static void ideapad_wmi_test_long_press(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	unsigned int saved = long_press_ms;
+
+	long_press_ms = 10000;
+
+	/* Followed by the firmware long-press in time */
+	ideapad_wmi_test_report(t, 0x01);
+	KUNIT_EXPECT_EQ(test, t->presses, 0);
+	ideapad_wmi_test_report(t, 0x08);
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_FAVORITES);
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, dropped), 1);
+
+	/* Expired, expiry is simulated to not depend on timing */
+	ideapad_wmi_test_report(t, 0x01);
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, hrtimer_cancel(&t->priv->long_press_timer), 1);
+	ideapad_wmi_long_press_expired(&t->priv->long_press_timer);
+	KUNIT_EXPECT_EQ(test, t->presses, 2);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_PROG1);
+
+	/* Expired before the input device got published, held back only once */
+	RCU_INIT_POINTER(t->priv->event_dev, NULL);
+	ideapad_wmi_long_press_expired(&t->priv->long_press_timer);
+	KUNIT_EXPECT_EQ(test, t->presses, 2);
+	KUNIT_EXPECT_TRUE(test, t->priv->star_key_pending);
+	ideapad_wmi_flush_pending(t->priv);
+	KUNIT_EXPECT_EQ(test, t->presses, 3);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_PROG1);
+	KUNIT_EXPECT_EQ(test, hrtimer_cancel(&t->priv->long_press_timer), 0);
+
+	/* A long-press right after the replay does not drop it */
+	ideapad_wmi_test_report(t, 0x08);
+	KUNIT_EXPECT_EQ(test, t->presses, 4);
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, dropped), 1);
+
+	long_press_ms = saved;
+}
+
+static void ideapad_wmi_test_macro(struct kunit *test)
+{
+	static const char macro[] = "0x27 29+46 47\n";
+	struct ideapad_wmi_test *t = test->priv;
+	struct device *dev = &t->wdev->dev;
+	char *buf;
+
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	KUNIT_ASSERT_EQ(test, macros_store(dev, NULL, macro, strlen(macro)),
+			(ssize_t)strlen(macro));
+	KUNIT_EXPECT_GT(test, macros_show(dev, NULL, buf), 0);
+	KUNIT_EXPECT_STREQ(test, buf, macro);
+
+	/* A chord and a single key, each step in a frame of its own */
+	ideapad_wmi_test_report(t, 0x27);
+	KUNIT_EXPECT_EQ(test, t->presses, 3);
+	KUNIT_EXPECT_EQ(test, t->releases, 3);
+	KUNIT_EXPECT_EQ(test, t->syncs, 4);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, 47);
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, key_events[0x27]), 1);
+
+	KUNIT_EXPECT_EQ(test, macros_store(dev, NULL, "0x27 0", 6), -EINVAL);
+	KUNIT_ASSERT_EQ(test, macros_store(dev, NULL, "", 0), 0);
+	ideapad_wmi_test_report(t, 0x27);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_HELP);
+}
+
+/* Remapping a key away must keep the keycodes that macros still emit */
+static void ideapad_wmi_test_macro_remap(struct kunit *test)
+{
+	static const char macro[] = "0x40 138\n";	/* KEY_HELP */
+	struct ideapad_wmi_test *t = test->priv;
+	struct input_dev *input_dev = t->priv->input_dev;
+	struct device *dev = &t->wdev->dev;
+	struct input_keymap_entry ke = {
+		.len = sizeof(u32),
+		.keycode = KEY_PROG1,
+	};
+	u32 scancode = 0x27;
+
+	memcpy(ke.scancode, &scancode, sizeof(scancode));
+
+	KUNIT_ASSERT_EQ(test, macros_store(dev, NULL, macro, strlen(macro)),
+			(ssize_t)strlen(macro));
+	KUNIT_ASSERT_EQ(test, input_set_keycode(input_dev, &ke), 0);
+	KUNIT_EXPECT_TRUE(test, test_bit(KEY_HELP, input_dev->keybit));
+
+	ideapad_wmi_test_report(t, 0x40);
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_HELP);
+
+	/* Without the macro the keycode goes */
+	KUNIT_ASSERT_EQ(test, macros_store(dev, NULL, "", 0), 0);
+	KUNIT_EXPECT_FALSE(test, test_bit(KEY_HELP, input_dev->keybit));
+}
+
+static void ideapad_wmi_test_single_frame(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+
+	ideapad_wmi_test_report(t, 0x12);
+
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, t->releases, 1);
+	KUNIT_EXPECT_EQ(test, t->syncs, 1);
+}
+
+static void ideapad_wmi_test_ignored(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+
+	ideapad_wmi_test_report(t, 0x02);
+
+	KUNIT_EXPECT_EQ(test, t->presses, 0);
+	KUNIT_EXPECT_EQ(test, t->syncs, 0);
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, ignored), 1);
+}
+
+static void ideapad_wmi_test_fn_lock(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct device *dev = &t->wdev->dev;
+	char *buf;
+
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	KUNIT_EXPECT_EQ(test, fn_lock_show(dev, NULL, buf), -ENODATA);
+
+	ideapad_wmi_test_report(t, 0x03);
+	KUNIT_EXPECT_EQ(test, fn_lock_show(dev, NULL, buf), 2);
+	KUNIT_EXPECT_STREQ(test, buf, "1\n");
+
+	ideapad_wmi_test_report(t, 0x02);
+	KUNIT_EXPECT_EQ(test, fn_lock_show(dev, NULL, buf), 2);
+	KUNIT_EXPECT_STREQ(test, buf, "0\n");
+
+	KUNIT_EXPECT_EQ(test, t->presses, 0);
+}
+
+static void ideapad_wmi_test_unknown(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+
+	ideapad_wmi_test_report(t, 0x40);
+
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_UNKNOWN);
+	KUNIT_EXPECT_EQ(test, atomic_read(&t->priv->unknown.hist[0x40]), 1);
+}
+
+static void ideapad_wmi_test_stats(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct device *dev = &t->wdev->dev;
+	char *buf;
+
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	KUNIT_ASSERT_GT(test, stats_show(dev, NULL, buf), 0);
+	KUNIT_EXPECT_NOT_NULL(test, strstr(buf, "last_event_ms -1\n"));
+
+	ideapad_wmi_inject_one(t->priv, 0x27);
+	ideapad_wmi_inject_one(t->priv, 0x02);
+	ideapad_wmi_inject_one(t->priv, 0x40);
+
+	KUNIT_ASSERT_GT(test, stats_show(dev, NULL, buf), 0);
+	KUNIT_EXPECT_TRUE(test, str_has_prefix(buf,
+		"events 3\nmapped 1\nignored 1\nunknown 1\nnot_integer 0\n"));
+	KUNIT_EXPECT_NULL(test, strstr(buf, "last_event_ms -1\n"));
+}
+
+/* Once registering failed, events are dropped instead of queued forever */
+static void ideapad_wmi_test_input_failed(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct device *dev = &t->wdev->dev;
+	char *buf;
+
+	buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	RCU_INIT_POINTER(t->priv->event_dev, NULL);
+	ideapad_wmi_inject_one(t->priv, 0x27);
+	KUNIT_EXPECT_EQ(test, kfifo_len(&t->priv->pending), 1);
+
+	ideapad_wmi_input_failed(t->priv, -ENOMEM);
+	KUNIT_EXPECT_TRUE(test, kfifo_is_empty(&t->priv->pending));
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, dropped), 1);
+
+	ideapad_wmi_inject_one(t->priv, 0x27);
+	KUNIT_EXPECT_TRUE(test, kfifo_is_empty(&t->priv->pending));
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, dropped), 2);
+	KUNIT_EXPECT_EQ(test, t->presses, 0);
+
+	KUNIT_ASSERT_GT(test, stats_show(dev, NULL, buf), 0);
+	KUNIT_EXPECT_NOT_NULL(test, strstr(buf, "input_error -12\n"));
+
+	rcu_assign_pointer(t->priv->event_dev, t->priv->input_dev);
+}
+
+/* Scancodes past the index go through the hash table, collisions included */
+static void ideapad_wmi_test_sparse(struct kunit *test)
+{
+	struct ideapad_wmi_keymap *keymap;
+	struct ideapad_wmi_key key = { .type = KE_KEY, .keycode = KEY_PROG1 };
+	struct ideapad_wmi_key *found;
+	unsigned int i;
+
+	keymap = ideapad_wmi_keymap_alloc(32);
+	KUNIT_ASSERT_NOT_NULL(test, keymap);
+
+	for (i = 0; i < 32; i++) {
+		key.scancode = 0x100 + (i << 8);
+		KUNIT_ASSERT_EQ(test, ideapad_wmi_keymap_add(keymap, &key), 0);
+	}
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_keymap_add(keymap, &key), -EEXIST);
+
+	/* Only scancodes in the index can be debounced */
+	key.scancode = 0x180;
+	key.debounce_ms = 5;
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_keymap_add(keymap, &key), -EINVAL);
+
+	for (i = 0; i < 32; i++) {
+		found = ideapad_wmi_keymap_lookup(keymap, 0x100 + (i << 8));
+		KUNIT_ASSERT_NOT_NULL(test, found);
+		KUNIT_EXPECT_EQ(test, found->scancode, 0x100 + (i << 8));
+	}
+	KUNIT_EXPECT_NULL(test, ideapad_wmi_keymap_lookup(keymap, 0x180));
+
+	kvfree(keymap);
+}
+
+static void ideapad_wmi_test_decode_buffer(struct kunit *test)
+{
+	static const u8 buf[] = {
+		0x01, 0x00, 0x00, 0x00,
+		0x12, 0x00, 0x00, 0x00,
+		0x13, 0x00,		/* Trailing partial word */
+	};
+	struct ideapad_wmi_event event = { };
+
+	ideapad_wmi_decode_buffer(&event, buf, sizeof(buf));
+
+	KUNIT_ASSERT_EQ(test, event.nr_scancodes, 2);
+	KUNIT_EXPECT_EQ(test, event.scancodes[0], 0x01);
+	KUNIT_EXPECT_EQ(test, event.scancodes[1], 0x12);
+	KUNIT_EXPECT_EQ(test, event.nr_dropped, 0);
+}
+
+static void ideapad_wmi_test_decode_overflow(struct kunit *test)
+{
+	__le32 buf[IDEAPAD_WMI_MAX_EVENT_SCANCODES + 1];
+	struct ideapad_wmi_event event = { };
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(buf); i++)
+		buf[i] = cpu_to_le32(0x01);
+
+	ideapad_wmi_decode_buffer(&event, (const u8 *)buf, sizeof(buf));
+
+	KUNIT_EXPECT_EQ(test, event.nr_scancodes, IDEAPAD_WMI_MAX_EVENT_SCANCODES);
+	KUNIT_EXPECT_EQ(test, event.nr_dropped, 1);
+}
+
+#ifndef IDEAPAD_WMI_BUFFER_NOTIFY
+static void ideapad_wmi_test_decode_package(struct kunit *test)
+{
+	union acpi_object elements[3] = {
+		{ .integer = { .type = ACPI_TYPE_INTEGER, .value = 0x01 } },
+		{ .type = ACPI_TYPE_STRING },
+		{ .integer = { .type = ACPI_TYPE_INTEGER, .value = 0x13 } },
+	};
+	union acpi_object data = {
+		.package = {
+			.type = ACPI_TYPE_PACKAGE,
+			.count = ARRAY_SIZE(elements),
+			.elements = elements,
+		},
+	};
+	struct ideapad_wmi_event event = { };
+
+	ideapad_wmi_decode_package(&event, &data);
+
+	KUNIT_ASSERT_EQ(test, event.nr_scancodes, 2);
+	KUNIT_EXPECT_EQ(test, event.scancodes[0], 0x01);
+	KUNIT_EXPECT_EQ(test, event.scancodes[1], 0x13);
+}
+#endif
+
+/* Goes through ideapad_wmi_notify() like a real WMI event */
+static void ideapad_wmi_test_notify(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+
+	ideapad_wmi_inject_one(t->priv, 0x27);
+
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+	KUNIT_EXPECT_EQ(test, t->last_keycode, KEY_HELP);
+}
+
+static void ideapad_wmi_test_suspended(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct device *dev = &t->wdev->dev;
+
+	KUNIT_ASSERT_EQ(test, ideapad_wmi_suspend(dev), 0);
+	ideapad_wmi_inject_one(t->priv, 0x27);
+	KUNIT_EXPECT_EQ(test, t->presses, 0);
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, dropped), 1);
+
+	KUNIT_ASSERT_EQ(test, ideapad_wmi_resume(dev), 0);
+	ideapad_wmi_inject_one(t->priv, 0x27);
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+}
+
+static void ideapad_wmi_test_deferred(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+
+	t->priv->delivery_wq = alloc_workqueue("ideapad-wmi-kunit", WQ_HIGHPRI, 0);
+	KUNIT_ASSERT_NOT_NULL(test, t->priv->delivery_wq);
+
+	ideapad_wmi_inject_one(t->priv, 0x27);
+	ideapad_wmi_inject_one(t->priv, 0x28);
+	flush_workqueue(t->priv->delivery_wq);
+
+	KUNIT_EXPECT_EQ(test, t->presses, 2);
+	KUNIT_EXPECT_TRUE(test, kfifo_is_empty(&t->priv->delivery));
+	KUNIT_EXPECT_EQ(test, ideapad_wmi_stats_read(t->priv, dropped), 0);
+}
+
+/* Removing the instance the input device hangs off hands it over */
+static void ideapad_wmi_test_instances(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct ideapad_wmi_private *priv = t->priv;
+	struct wmi_device *wdev;
+
+	wdev = ideapad_wmi_test_add_device(test, "ideapad-wmi-kunit.1");
+	KUNIT_ASSERT_NOT_NULL(test, wdev);
+
+	ideapad_wmi_shared = priv;
+	KUNIT_ASSERT_EQ(test, ideapad_wmi_probe(wdev, NULL), 0);
+	KUNIT_EXPECT_PTR_EQ(test, dev_get_drvdata(&wdev->dev), priv);
+
+	ideapad_wmi_remove(t->wdev);
+	KUNIT_EXPECT_PTR_EQ(test, priv->wmi_device, wdev);
+	KUNIT_EXPECT_PTR_EQ(test, priv->input_dev->dev.parent, &wdev->dev);
+	ideapad_wmi_inject_one(priv, 0x27);
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+
+	/* And back, the fixture tears down what it set up */
+	KUNIT_ASSERT_EQ(test, ideapad_wmi_probe(t->wdev, NULL), 0);
+	ideapad_wmi_remove(wdev);
+	KUNIT_EXPECT_PTR_EQ(test, priv->wmi_device, t->wdev);
+	KUNIT_EXPECT_PTR_EQ(test, priv->input_dev->dev.parent, &t->wdev->dev);
+
+	ideapad_wmi_shared = NULL;
+	device_unregister(&wdev->dev);
+}
+
+struct ideapad_wmi_test_listener {
+	struct notifier_block nb;
+	struct ideapad_wmi_fn_key key;
+	unsigned long action;
+	unsigned int calls;
+};
+
+static int ideapad_wmi_test_key_notify(struct notifier_block *nb,
+				       unsigned long action, void *data)
+{
+	struct ideapad_wmi_test_listener *l =
+		container_of(nb, struct ideapad_wmi_test_listener, nb);
+
+	l->key = *(struct ideapad_wmi_fn_key *)data;
+	l->action = action;
+	l->calls++;
+
+	return NOTIFY_OK;
+}
+
+static void ideapad_wmi_test_notifier(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	struct ideapad_wmi_test_listener l = {
+		.nb.notifier_call = ideapad_wmi_test_key_notify,
+	};
+
+	KUNIT_ASSERT_EQ(test, ideapad_wmi_fn_keys_register_notifier(&l.nb), 0);
+	ideapad_wmi_test_report(t, 0x27);
+	ideapad_wmi_test_report(t, 0x02);
+	ideapad_wmi_fn_keys_unregister_notifier(&l.nb);
+
+	/* Ignored scancodes are not published */
+	KUNIT_EXPECT_EQ(test, l.calls, 1);
+	KUNIT_EXPECT_EQ(test, l.action, KEY_HELP);
+	KUNIT_EXPECT_EQ(test, l.key.scancode, 0x27);
+	KUNIT_EXPECT_EQ(test, l.key.keycode, KEY_HELP);
+	KUNIT_EXPECT_EQ(test, t->presses, 1);
+}
+
+static void ideapad_wmi_test_driver(struct kunit *test)
+{
+	KUNIT_EXPECT_STREQ(test, ideapad_wmi_driver.id_table[0].guid_string,
+			   IDEAPAD_FN_KEY_EVENT_GUID);
+	KUNIT_EXPECT_PTR_EQ(test, ideapad_wmi_driver.probe, ideapad_wmi_probe);
+	KUNIT_EXPECT_PTR_EQ(test, ideapad_wmi_driver.remove, ideapad_wmi_remove);
+}
+
+static struct kunit_case ideapad_wmi_test_cases[] = {
+	KUNIT_CASE(ideapad_wmi_test_known),
+	KUNIT_CASE(ideapad_wmi_test_long_press),
+	KUNIT_CASE(ideapad_wmi_test_macro),
+	KUNIT_CASE(ideapad_wmi_test_macro_remap),
+	KUNIT_CASE(ideapad_wmi_test_single_frame),
+	KUNIT_CASE(ideapad_wmi_test_ignored),
+	KUNIT_CASE(ideapad_wmi_test_fn_lock),
+	KUNIT_CASE(ideapad_wmi_test_unknown),
+	KUNIT_CASE(ideapad_wmi_test_sparse),
+	KUNIT_CASE(ideapad_wmi_test_stats),
+	KUNIT_CASE(ideapad_wmi_test_input_failed),
+	KUNIT_CASE(ideapad_wmi_test_decode_buffer),
+	KUNIT_CASE(ideapad_wmi_test_decode_overflow),
+#ifndef IDEAPAD_WMI_BUFFER_NOTIFY
+	KUNIT_CASE(ideapad_wmi_test_decode_package),
+#endif
+	KUNIT_CASE(ideapad_wmi_test_notify),
+	KUNIT_CASE(ideapad_wmi_test_notifier),
+	KUNIT_CASE(ideapad_wmi_test_suspended),
+	KUNIT_CASE(ideapad_wmi_test_deferred),
+	KUNIT_CASE(ideapad_wmi_test_instances),
+	KUNIT_CASE(ideapad_wmi_test_driver),
+	{ }
+};
+
+static struct kunit_suite ideapad_wmi_test_suite = {
+	.name = "ideapad-wmi-fn-keys",
+	.init = ideapad_wmi_test_init,
+	.exit = ideapad_wmi_test_exit,
+	.test_cases = ideapad_wmi_test_cases,
+};
+
+static void ideapad_wmi_bench_report(struct kunit *test, const char *name,
+				     u32 scancode)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	unsigned int i;
+	u64 start, ns;
+
+	start = ktime_get_ns();
+	for (i = 0; i < IDEAPAD_WMI_BENCH_EVENTS; i++)
+		ideapad_wmi_test_report(t, scancode);
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "%s: %llu ns/event\n", name,
+		   div_u64(ns, IDEAPAD_WMI_BENCH_EVENTS));
+}
+
+static void ideapad_wmi_bench_known(struct kunit *test)
+{
+	ideapad_wmi_bench_report(test, "known", 0x01);
+}
+
+static void ideapad_wmi_bench_ignored(struct kunit *test)
+{
+	ideapad_wmi_bench_report(test, "ignored", 0x02);
+}
+
+/* Misses the index and probes the hash table */
+static void ideapad_wmi_bench_unknown(struct kunit *test)
+{
+	ideapad_wmi_bench_report(test, "unknown", 0x40);
+}
+
+static void ideapad_wmi_bench_notify(struct kunit *test)
+{
+	struct ideapad_wmi_test *t = test->priv;
+	unsigned int i;
+	u64 start, ns;
+
+	start = ktime_get_ns();
+	for (i = 0; i < IDEAPAD_WMI_BENCH_EVENTS; i++)
+		ideapad_wmi_inject_one(t->priv, 0x01);
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "notify: %llu ns/event\n",
+		   div_u64(ns, IDEAPAD_WMI_BENCH_EVENTS));
+}
+
+static struct kunit_case ideapad_wmi_bench_cases[] = {
+	KUNIT_CASE_SLOW(ideapad_wmi_bench_known),
+	KUNIT_CASE_SLOW(ideapad_wmi_bench_ignored),
+	KUNIT_CASE_SLOW(ideapad_wmi_bench_unknown),
+	KUNIT_CASE_SLOW(ideapad_wmi_bench_notify),
+	{ }
+};
+
+static struct kunit_suite ideapad_wmi_bench_suite = {
+	.name = "ideapad-wmi-fn-keys-bench",
+	.init = ideapad_wmi_test_init,
+	.exit = ideapad_wmi_test_exit,
+	.test_cases = ideapad_wmi_bench_cases,
+};
+
+kunit_test_suites(&ideapad_wmi_test_suite, &ideapad_wmi_bench_suite);
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * ideapad-wmi-fn-keys-notifier.h - Key press notifier of the Ideapad WMI fn
+ * keys driver
+ *
+ * Drivers with an input device of their own, such as ideapad-laptop, can
+ * subscribe to every key press and report it themselves. Loading
+ * ideapad-wmi-fn-keys with input_device=0 then leaves userspace with a single
+ * evdev node for all hotkeys.
+ */
+
+#ifndef _IDEAPAD_WMI_FN_KEYS_NOTIFIER_H
+#define _IDEAPAD_WMI_FN_KEYS_NOTIFIER_H
+
+#include <linux/types.h>
+
+struct notifier_block;
+
+/*
+ * Passed as data, the action is the keycode. keycode is KEY_UNKNOWN for
+ * unmapped scancodes. Keys are pressed and released at once.
+ */
+struct ideapad_wmi_fn_key {
+	u32 scancode;
+	unsigned int keycode;
+};
+
+int ideapad_wmi_fn_keys_register_notifier(struct notifier_block *nb);
+int ideapad_wmi_fn_keys_unregister_notifier(struct notifier_block *nb);
+
+#endif /* _IDEAPAD_WMI_FN_KEYS_NOTIFIER_H */
@@ -15,121 +15,3488 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/bitmap.h>
+#include <linux/cpumask.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/device.h>
+#include <linux/dmi.h>
+#include <linux/error-injection.h>
+#include <linux/firmware.h>
+#include <linux/hash.h>
+#include <linux/hrtimer.h>
 #include <linux/input.h>
 #include <linux/input/sparse-keymap.h>
+#include <linux/jiffies.h>
+#include <linux/jump_label.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/notifier.h>
+#include <linux/percpu.h>
+#include <linux/pm.h>
+#include <linux/pm_wakeup.h>
+#include <linux/poll.h>
+#include <linux/ratelimit.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 #include <linux/wmi.h>
+#include <linux/workqueue.h>
+
+#include "ideapad-wmi-fn-keys.h"
+#include "ideapad-wmi-fn-keys-notifier.h"
+
+/*
+ * Newer kernels hand WMI events to drivers as marshalled buffers instead of
+ * evaluated ACPI objects, which saves an allocation and a type check per
+ * event.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 19, 0)
+#define IDEAPAD_WMI_BUFFER_NOTIFY
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
+
+/* fmod_ret filter hook with kfuncs, see ideapad_wmi_bpf_filter() */
+#if IS_ENABLED(CONFIG_BPF_SYSCALL) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+#define IDEAPAD_WMI_BPF
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 15, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_clear(struct vm_area_struct *vma,
+				  unsigned long flags)
+{
+	vma->vm_flags &= ~flags;
+}
+#endif
+
+/* The KUnit module compiles the tracepoints out, they belong to the driver */
+#ifndef IDEAPAD_WMI_KUNIT
+#define CREATE_TRACE_POINTS
+#endif
+#include "trace.h"
 
 #define IDEAPAD_FN_KEY_EVENT_GUID	"8FC0DE0C-B4E4-43FD-B0F3-8871711C1294"
 
-struct ideapad_wmi_private {
-	struct wmi_device *wmi_device;
-	struct input_dev *input_dev;
+/*
+ * Scancodes below this value are resolved through a direct-indexed table,
+ * everything else through the keymap's hash table.
+ */
+#define IDEAPAD_WMI_KEYMAP_INDEX_SIZE	0x30
+
+/* FnLock is toggled by the firmware, which only reports the new state */
+#define IDEAPAD_WMI_FN_LOCK_OFF		0x02
+#define IDEAPAD_WMI_FN_LOCK_ON		0x03
+
+/* The star key, the firmware follows up with the long-press after its timeout */
+#define IDEAPAD_WMI_STAR_KEY		0x01
+#define IDEAPAD_WMI_STAR_KEY_LONG	0x08
+
+/* Press and release are reported within a single input frame */
+#define IDEAPAD_WMI_KEY_SINGLE_FRAME	BIT(0)
+/* Wakes the system while suspended, if enabled in power/wakeup */
+#define IDEAPAD_WMI_KEY_WAKEUP		BIT(1)
+#define IDEAPAD_WMI_KEY_FLAGS		(IDEAPAD_WMI_KEY_SINGLE_FRAME | \
+					 IDEAPAD_WMI_KEY_WAKEUP)
+
+/*
+ * Per-scancode key sequences replacing the keymap entry. A sequence is a run
+ * of keycodes in the arena, keys with IDEAPAD_WMI_MACRO_CHORD are held down
+ * together with the next one.
+ */
+#define IDEAPAD_WMI_MAX_MACROS		16
+#define IDEAPAD_WMI_MACRO_ARENA_SIZE	256
+#define IDEAPAD_WMI_MACRO_CHORD		BIT(15)
+
+struct ideapad_wmi_macro {
+	u32 scancode;
+	u16 start;
+	u16 len;
+};
+
+struct ideapad_wmi_macros {
+	unsigned int nr_macros;
+	unsigned int nr_keys;
+	struct ideapad_wmi_macro macros[IDEAPAD_WMI_MAX_MACROS];
+	u16 keys[IDEAPAD_WMI_MACRO_ARENA_SIZE];
+};
+
+struct ideapad_wmi_key {
+	u32 scancode;
+	/* Written in place by EVIOCSKEYCODE, read with READ_ONCE() */
+	u16 keycode;
+	u8 type;
+	u8 flags;
+	/* Overrides the debounce_ms module parameter if non-zero */
+	u16 debounce_ms;
+};
+
+/*
+ * Keymap firmware layout, all fields little-endian: a header followed by
+ * nr_keys key records. type is KE_KEY or KE_IGNORE, flags a combination of
+ * IDEAPAD_WMI_KEY_* and debounce_ms works like the "debounce=" option.
+ */
+#define IDEAPAD_WMI_FW_MAGIC		0x4b465749	/* "IWFK" */
+#define IDEAPAD_WMI_FW_VERSION		1
+
+struct ideapad_wmi_fw_header {
+	__le32 magic;
+	__le16 version;
+	__le16 nr_keys;
+} __packed;
+
+struct ideapad_wmi_fw_key {
+	__le32 scancode;
+	__le16 keycode;
+	u8 type;
+	u8 flags;
+	__le16 debounce_ms;
+	__le16 reserved;
+} __packed;
+
+/*
+ * The keymap is never modified apart from keycodes, a new table is published
+ * with RCU and the old one freed after a grace period instead.
+ */
+struct ideapad_wmi_keymap {
+	struct rcu_head rcu;
+	struct ideapad_wmi_key *index[IDEAPAD_WMI_KEYMAP_INDEX_SIZE];
+	/*
+	 * Open addressed with linear probing and at most half full, a slot
+	 * holds the index of its key in keys plus one or 0 if empty. Lives
+	 * in the same allocation, right after keys.
+	 */
+	u16 *hash;
+	unsigned int hash_bits;
+	unsigned int nr_keys;
+	struct ideapad_wmi_key keys[];
+};
+
+/*
+ * Unknown scancodes are counted per code up to this value, anything above
+ * lands in a single overflow bucket.
+ */
+#define IDEAPAD_WMI_UNKNOWN_HIST_SIZE	0x100
+#define IDEAPAD_WMI_UNKNOWN_SUMMARY_INTERVAL	(60 * HZ)
+
+struct ideapad_wmi_unknown_stats {
+	atomic_t hist[IDEAPAD_WMI_UNKNOWN_HIST_SIZE];
+	atomic_t overflow;
+	/* Repeated events since the last summary was logged */
+	atomic_t pending;
+	DECLARE_BITMAP(seen, IDEAPAD_WMI_UNKNOWN_HIST_SIZE);
+	/* First occurrences the log work has not reported yet */
+	DECLARE_BITMAP(unlogged, IDEAPAD_WMI_UNKNOWN_HIST_SIZE);
+	/* Last WMI event data type the driver could not decode, 0 once logged */
+	u32 unsupported_type;
+	struct ratelimit_state summary_rs;
+};
+
+/*
+ * Maximum number of keys pressed within a single input frame. Events
+ * carrying more scancodes are split into several frames.
+ */
+#define IDEAPAD_WMI_MAX_BATCH		16
+
+/* Maximum number of scancodes decoded from a single WMI event */
+#define IDEAPAD_WMI_MAX_EVENT_SCANCODES	16
+
+struct ideapad_wmi_event {
+	u32 scancodes[IDEAPAD_WMI_MAX_EVENT_SCANCODES];
+	unsigned int nr_scancodes;
+	/* Scancodes that did not fit into scancodes[] */
+	unsigned int nr_dropped;
+	/* Package elements that were not integers */
+	unsigned int nr_not_integer;
+};
+
+/* Scancodes queued while the input device is still being registered */
+#define IDEAPAD_WMI_PENDING_SIZE	32
+
+/* Scancodes handed from the notify path to the delivery worker */
+#define IDEAPAD_WMI_DELIVERY_SIZE	64
+
+/* Keys pressed in the current input frame, released when it is flushed */
+struct ideapad_wmi_frame {
+	struct input_dev *input_dev;
+	unsigned int release[IDEAPAD_WMI_MAX_BATCH];
+	unsigned int nr_release;
+	bool pending;
+};
+
+/* Bucket n counts latencies in [2^n, 2^(n+1)) ns, the last one is open ended */
+#define IDEAPAD_WMI_LATENCY_BUCKETS	32
+
+struct ideapad_wmi_latency_stats {
+	u64 hist[IDEAPAD_WMI_LATENCY_BUCKETS];
+	u64 count;
+	u64 sum_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+/*
+ * Per-CPU event counters, summed up only when read. Mapped scancodes outside
+ * of the keymap index are counted in key_events_other, a scancode expanded by
+ * a macro counts once like a mapped one. dropped counts the
+ * scancodes that did not fit into an event, overflowed the pending queue
+ * before the input device was registered or the deferred delivery fifo,
+ * arrived after registering the input device failed or while suspended, or
+ * were star key presses superseded by a long-press. events counts WMI
+ * notifications, last_event holds the jiffies of the latest one on this CPU.
+ */
+struct ideapad_wmi_stats {
+	u64 key_events[IDEAPAD_WMI_KEYMAP_INDEX_SIZE];
+	u64 key_events_other;
+	u64 ignored;
+	u64 debounced;
+	u64 dropped;
+	u64 filtered;
+	u64 unknown;
+	u64 not_integer;
+	u64 events;
+	unsigned long last_event;
+};
+
+/*
+ * Raw WMI event as recorded into the events ring buffer and accepted by the
+ * replay file, all fields little-endian. length is the size of the event
+ * data, of which at most the first 48 bytes are kept. Integers are stored as
+ * 64-bit values, packages as one 32-bit value per element.
+ */
+#define IDEAPAD_WMI_RECORD_DATA_SIZE	48
+
+struct ideapad_wmi_record {
+	__le64 timestamp_ns;
+	__le32 seq;
+	__le16 type;
+	__le16 length;
+	u8 data[IDEAPAD_WMI_RECORD_DATA_SIZE];
+} __packed;
+
+/* Number of records kept, must be a power of two */
+#define IDEAPAD_WMI_RECORD_RING_SIZE	256
+
+/* Replay sleeps at most this long between two events */
+#define IDEAPAD_WMI_REPLAY_MAX_GAP_NS	NSEC_PER_SEC
+
+/* state is the ring position plus one once the record is complete, else 0 */
+struct ideapad_wmi_record_slot {
+	u64 state;
+	struct ideapad_wmi_record record;
+};
+
+/* Pages of records in the event ring, following the header page */
+#define IDEAPAD_WMI_RING_DATA_PAGES	1
+#define IDEAPAD_WMI_RING_RECORDS	\
+	(IDEAPAD_WMI_RING_DATA_PAGES * PAGE_SIZE / sizeof(struct ideapad_wmi_ring_record))
+
+/*
+ * Event ring behind the misc device, see ideapad-wmi-fn-keys.h. Freed once
+ * the WMI device is gone and the last file is closed.
+ */
+struct ideapad_wmi_ring {
+	struct kref kref;
+	struct miscdevice misc;
+	struct ideapad_wmi_ring_header *header;
+	struct ideapad_wmi_ring_record *records;
+	/* Serializes writers, readers only look at the mapping */
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	/* head as of the last wakeup */
+	u64 woken;
+	bool dead;
+};
+
+/* Per open file, head as returned by the last read() */
+struct ideapad_wmi_ring_reader {
+	struct ideapad_wmi_ring *ring;
+	u64 seen;
+};
+
+/* Outcome of the last debugfs injector run */
+struct ideapad_wmi_inject_result {
+	u64 events;
+	u64 dropped;
+	u64 elapsed_ns;
+};
+
+/*
+ * Buffers the notify path works in, allocated once at probe so that handling
+ * an event never allocates.
+ */
+struct ideapad_wmi_arena {
+	struct ideapad_wmi_record_slot records[IDEAPAD_WMI_RECORD_RING_SIZE];
+	struct ideapad_wmi_macros macros[2];
+};
+
+/* One per bound WMI device, all of them feed the same ideapad_wmi_private */
+struct ideapad_wmi_instance {
+	struct wmi_device *wdev;
+	struct list_head node;
+};
+
+struct ideapad_wmi_private {
+	/*
+	 * The instance the input and misc devices hang off, handed over to
+	 * another one if it goes away first. Changes under inject_lock.
+	 */
+	struct wmi_device *wmi_device;
+	/*
+	 * Bound instances, changed under both ideapad_wmi_shared_lock and
+	 * instances_lock. The last one to go tears everything down.
+	 */
+	struct list_head instances;
+	struct mutex instances_lock;
+	/* Owned by probe/remove, updated under keymap_lock */
+	struct input_dev *input_dev;
+	/*
+	 * input_dev as seen by the notify path, published once registered and
+	 * unpublished before it is unregistered. Events are queued in pending
+	 * while it is NULL.
+	 */
+	struct input_dev __rcu *event_dev;
+	/* Registers the input device off the probe path */
+	struct work_struct input_work;
+	ktime_t probe_start;
+	spinlock_t pending_lock;
+	DECLARE_KFIFO(pending, u32, IDEAPAD_WMI_PENDING_SIZE);
+	/*
+	 * Set under pending_lock if registering the input device failed,
+	 * events are dropped instead of queued from then on.
+	 */
+	int input_err;
+	/*
+	 * A star key press resolved as a short press while the input device
+	 * was not published, reported first by ideapad_wmi_flush_pending()
+	 * without holding it back again. Protected by pending_lock.
+	 */
+	bool star_key_pending;
+	/*
+	 * Only set with deferred_delivery. The worker is the only consumer
+	 * of delivery and reads it locklessly, producers serialize on
+	 * delivery_lock.
+	 */
+	struct workqueue_struct *delivery_wq;
+	struct work_struct delivery_work;
+	spinlock_t delivery_lock;
+	DECLARE_KFIFO(delivery, u32, IDEAPAD_WMI_DELIVERY_SIZE);
+	/* Notify time of the oldest scancode in delivery, for latency_stats */
+	ktime_t delivery_start;
+	struct dentry *debugfs_dir;
+	/* Serializes injector runs */
+	struct mutex inject_lock;
+	struct ideapad_wmi_inject_result inject;
+	struct ideapad_wmi_arena *arena;
+	/* Raw event ring in the arena, filled while record_events is set */
+	struct ideapad_wmi_record_slot *records;
+	atomic64_t record_head;
+	/* Only set with event_ring, fixed between probe and remove */
+	struct ideapad_wmi_ring *ring;
+	/* Last FnLock scancode seen, 0 until the firmware reported one */
+	u32 fn_lock;
+	/* Events are dropped between suspend and resume */
+	bool suspended;
+	/* Bit 0 is set once a wakeup key reported a wakeup event */
+	unsigned long wakeup_pending;
+	/* Holds back the star key for long_press_ms */
+	struct hrtimer long_press_timer;
+	/* Notifies fn_lock pollers, sysfs_notify() may sleep */
+	struct work_struct fn_lock_work;
+	/*
+	 * Two macro buffers in the arena, one published in macros and one
+	 * spare that sysfs writes parse into. macros is NULL without any
+	 * macro and updated under keymap_lock.
+	 */
+	struct ideapad_wmi_macros *macro_arena;
+	struct ideapad_wmi_macros __rcu *macros;
+	unsigned int macro_spare;
+	/* Serializes macro updates, the spare buffer belongs to its holder */
+	struct mutex macro_lock;
+	struct ideapad_wmi_keymap __rcu *keymap;
+	/* Serializes keymap updates from sysfs and EVIOCSKEYCODE */
+	spinlock_t keymap_lock;
+	struct ideapad_wmi_unknown_stats unknown;
+	/* Logs on behalf of the notify path, which never printks itself */
+	struct delayed_work log_work;
+	/* Time of the last reported event per indexed scancode */
+	u64 last_event_ns[IDEAPAD_WMI_KEYMAP_INDEX_SIZE];
+	struct ideapad_wmi_stats __percpu *stats;
+	struct ideapad_wmi_latency_stats __percpu *latency;
+};
+
+static struct dentry *ideapad_wmi_debugfs_root;
+
+static ATOMIC_NOTIFIER_HEAD(ideapad_wmi_fn_keys_chain);
+
+/* Serializes probe and remove, protects ideapad_wmi_shared */
+static DEFINE_MUTEX(ideapad_wmi_shared_lock);
+/* Shared by all bound instances, NULL while none is bound */
+static struct ideapad_wmi_private *ideapad_wmi_shared;
+
+static DEFINE_STATIC_KEY_FALSE(ideapad_wmi_latency_enabled);
+
+static DEFINE_STATIC_KEY_FALSE(ideapad_wmi_record_enabled);
+
+#ifdef IDEAPAD_WMI_BPF
+static DEFINE_STATIC_KEY_FALSE(ideapad_wmi_bpf_enabled);
+#endif
+
+/*
+ * Built with IDEAPAD_WMI_DEBUG_HOT_PATH=1, the notify path and each batch of
+ * the deferred delivery worker run with preemption disabled so that
+ * might_sleep() catches anything sleeping or allocating with GFP_KERNEL
+ * under them. The helpers that allocate or log warn when called from there.
+ */
+#ifdef IDEAPAD_WMI_DEBUG_HOT_PATH
+static DEFINE_PER_CPU(bool, ideapad_wmi_hot);
+
+static void ideapad_wmi_hot_enter(void)
+{
+	preempt_disable();
+	__this_cpu_write(ideapad_wmi_hot, true);
+}
+
+static void ideapad_wmi_hot_exit(void)
+{
+	__this_cpu_write(ideapad_wmi_hot, false);
+	preempt_enable();
+}
+
+static void ideapad_wmi_assert_cold(void)
+{
+	WARN_ON_ONCE(raw_cpu_read(ideapad_wmi_hot));
+}
+#else
+static inline void ideapad_wmi_hot_enter(void) { }
+static inline void ideapad_wmi_hot_exit(void) { }
+static inline void ideapad_wmi_assert_cold(void) { }
+#endif
+
+/* Boolean parameters backed by the static key passed as argument */
+static int ideapad_wmi_static_key_set(const char *val,
+				      const struct kernel_param *kp)
+{
+	struct static_key_false *key = kp->arg;
+	bool enable;
+	int err;
+
+	err = kstrtobool(val, &enable);
+	if (err)
+		return err;
+
+	if (enable)
+		static_branch_enable(key);
+	else
+		static_branch_disable(key);
+
+	return 0;
+}
+
+static int ideapad_wmi_static_key_get(char *buffer,
+				      const struct kernel_param *kp)
+{
+	struct static_key_false *key = kp->arg;
+
+	return sysfs_emit(buffer, "%c\n", static_key_enabled(key) ? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops ideapad_wmi_static_key_ops = {
+	.set = ideapad_wmi_static_key_set,
+	.get = ideapad_wmi_static_key_get,
+};
+
+module_param_cb(latency_stats, &ideapad_wmi_static_key_ops,
+		&ideapad_wmi_latency_enabled, 0644);
+MODULE_PARM_DESC(latency_stats,
+		 "Collect notify to input_sync latency statistics in debugfs");
+
+module_param_cb(record_events, &ideapad_wmi_static_key_ops,
+		&ideapad_wmi_record_enabled, 0644);
+MODULE_PARM_DESC(record_events,
+		 "Record raw WMI events into the debugfs events ring buffer");
+
+#ifdef IDEAPAD_WMI_BPF
+module_param_cb(bpf_filter, &ideapad_wmi_static_key_ops,
+		&ideapad_wmi_bpf_enabled, 0644);
+MODULE_PARM_DESC(bpf_filter,
+		 "Pass every scancode through the ideapad_wmi_bpf_filter() BPF hook");
+#endif
+
+static char *keymap_firmware = "ideapad-wmi-fn-keys.bin";
+module_param(keymap_firmware, charp, 0444);
+MODULE_PARM_DESC(keymap_firmware,
+		 "Firmware file overriding the built-in keymap, empty to disable");
+
+static bool input_device = true;
+module_param(input_device, bool, 0444);
+MODULE_PARM_DESC(input_device,
+		 "Register an own input device, disable to only publish keys through the notifier (default: true)");
+
+static bool deferred_delivery;
+module_param(deferred_delivery, bool, 0444);
+MODULE_PARM_DESC(deferred_delivery,
+		 "Report keys from a high priority worker instead of the ACPI notify workqueue");
+
+static int delivery_cpu = -1;
+module_param(delivery_cpu, int, 0644);
+MODULE_PARM_DESC(delivery_cpu,
+		 "CPU the deferred_delivery worker runs on (default: -1, the notifying CPU)");
+
+static bool event_ring;
+module_param(event_ring, bool, 0444);
+MODULE_PARM_DESC(event_ring,
+		 "Expose key presses through an mmap()able ring on /dev/ideapad-wmi-fn-keys");
+
+static unsigned int debounce_ms;
+module_param(debounce_ms, uint, 0644);
+MODULE_PARM_DESC(debounce_ms,
+		 "Drop repeated scancodes within this many milliseconds (default: 0, disabled)");
+
+static unsigned int long_press_ms;
+module_param(long_press_ms, uint, 0644);
+MODULE_PARM_DESC(long_press_ms,
+		 "Hold back the star key this many milliseconds and only report the long-press if it follows (default: 0, disabled)");
+
+/*
+ * The built-in keys are lists of key(scancode, keycode) and ignore(scancode)
+ * entries, expanded into the sparse keymaps below and into
+ * ideapad_wmi_keymaps_check().
+ */
+#define IDEAPAD_WMI_FN_KEYS(key, ignore)					\
+	/* Customizable Lenovo Hotkey (Acts on Windows as macro key) ("star" with 'S' inside) */ \
+	key(IDEAPAD_WMI_STAR_KEY, KEY_PROG1)					\
+	/* Disable FnLock (handled by the firmware, tracked in fn_lock) */	\
+	ignore(IDEAPAD_WMI_FN_LOCK_OFF)						\
+	/* Enable FnLock (handled by the firmware, tracked in fn_lock) */	\
+	ignore(IDEAPAD_WMI_FN_LOCK_ON)						\
+	/*									\
+	 * Snipping (dashed circle with scissors)				\
+	 *									\
+	 * Better fit would be KEY_SELECTIVE_SCREENSHOT, but:			\
+	 * - Not supported by xorg-x11proto:					\
+	 *   https://github.com/freedesktop/xorg-x11proto/blob/master/XF86keysym.h \
+	 * - Not supported by Qt:						\
+	 *   https://doc.qt.io/qt-6/qt.html#Key-enum				\
+	 * - Not supported by KDE:						\
+	 *   https://github.com/KDE/kwindowsystem/blob/9d5cf1a99f71ce2b0efd608c6899171c6ce4e25d/src/platforms/xcb/kkeyserver.cpp \
+	 */									\
+	key(0x04, KEY_F14)							\
+	/* Customizable Lenovo Hotkey ("star" with 'S' inside) (long-press) */	\
+	key(IDEAPAD_WMI_STAR_KEY_LONG, KEY_FAVORITES)				\
+	/* Sound profile switch */						\
+	key(0x12, KEY_PROG2)							\
+	/* Dark mode toggle */							\
+	key(0x13, KEY_PROG3)							\
+	/* Lenovo Support */							\
+	key(0x27, KEY_HELP)							\
+	/* Lenovo Virtual Background application */				\
+	key(0x28, KEY_PROG4)
+
+/* Additional keys for Thinkbook 16p2 */
+#define IDEAPAD_WMI_THINKBOOK_KEYS(key, ignore)				\
+	key(0x0e, KEY_PICKUP_PHONE)						\
+	key(0x0f, KEY_HANGUP_PHONE)
+
+#define IDEAPAD_WMI_KE_KEY(scancode, keycode)	{ KE_KEY, scancode, { keycode } },
+#define IDEAPAD_WMI_KE_IGNORE(scancode)		{ KE_IGNORE, scancode },
+
+static const struct key_entry ideapad_wmi_fn_key_keymap[] = {
+	IDEAPAD_WMI_FN_KEYS(IDEAPAD_WMI_KE_KEY, IDEAPAD_WMI_KE_IGNORE)
+
+	{ KE_END },
+};
+
+static const struct key_entry ideapad_wmi_thinkbook_keymap[] = {
+	IDEAPAD_WMI_THINKBOOK_KEYS(IDEAPAD_WMI_KE_KEY, IDEAPAD_WMI_KE_IGNORE)
+
+	{ KE_END },
+};
+
+/*
+ * Never called, it only fails the build. The default keymap combines every
+ * table, so a scancode listed twice shows up as a duplicate case label.
+ * Keycodes past KEY_MAX make the case label itself invalid.
+ */
+#define IDEAPAD_WMI_CHECK_KEY(scancode, keycode)			\
+	case (scancode) + BUILD_BUG_ON_ZERO((keycode) > KEY_MAX):
+#define IDEAPAD_WMI_CHECK_IGNORE(scancode)	case (scancode):
+
+static void __maybe_unused ideapad_wmi_keymaps_check(u32 scancode)
+{
+	switch (scancode) {
+	IDEAPAD_WMI_FN_KEYS(IDEAPAD_WMI_CHECK_KEY, IDEAPAD_WMI_CHECK_IGNORE)
+	IDEAPAD_WMI_THINKBOOK_KEYS(IDEAPAD_WMI_CHECK_KEY,
+				   IDEAPAD_WMI_CHECK_IGNORE)
+		break;
+	}
+}
+
+/* NULL terminated lists of the keymaps making up a model's keymap */
+static const struct key_entry *const ideapad_wmi_yoga_keymaps[] = {
+	ideapad_wmi_fn_key_keymap,
+	NULL
+};
+
+static const struct key_entry *const ideapad_wmi_thinkbook_keymaps[] = {
+	ideapad_wmi_fn_key_keymap,
+	ideapad_wmi_thinkbook_keymap,
+	NULL
+};
+
+/* Used for models missing from ideapad_wmi_dmi_table */
+static const struct key_entry *const ideapad_wmi_default_keymaps[] = {
+	ideapad_wmi_fn_key_keymap,
+	ideapad_wmi_thinkbook_keymap,
+	NULL
+};
+
+static const struct dmi_system_id ideapad_wmi_dmi_table[] = {
+	{
+		.ident = "Lenovo Yoga 9 14IAP7",
+		.matches = {
+			DMI_MATCH(DMI_SYS_VENDOR, "LENOVO"),
+			DMI_MATCH(DMI_PRODUCT_VERSION, "Yoga 9 14IAP7"),
+		},
+		.driver_data = (void *)ideapad_wmi_yoga_keymaps,
+	},
+	{
+		.ident = "Lenovo Yoga 9 14ITL5",
+		.matches = {
+			DMI_MATCH(DMI_SYS_VENDOR, "LENOVO"),
+			DMI_MATCH(DMI_PRODUCT_VERSION, "Yoga 9 14ITL5"),
+		},
+		.driver_data = (void *)ideapad_wmi_yoga_keymaps,
+	},
+	{
+		.ident = "Lenovo Thinkbook 16p2",
+		.matches = {
+			DMI_MATCH(DMI_SYS_VENDOR, "LENOVO"),
+			DMI_MATCH(DMI_PRODUCT_VERSION, "ThinkBook 16p G2"),
+		},
+		.driver_data = (void *)ideapad_wmi_thinkbook_keymaps,
+	},
+	{ }
+};
+
+/* Keymaps of the machine we are running on, chosen once at module init */
+static const struct key_entry *const *ideapad_wmi_model_keymaps __ro_after_init =
+	ideapad_wmi_default_keymaps;
+
+/*
+ * Keys that only trigger an action in userspace get their press and release
+ * reported within a single input frame, which wakes up evdev clients once
+ * instead of twice. Keys that may be held or combined stay out of this.
+ */
+static const unsigned int ideapad_wmi_single_frame_scancodes[] = {
+	0x12,	/* Sound profile switch */
+	0x13,	/* Dark mode toggle */
+	0x27,	/* Lenovo Support */
+	0x28,	/* Lenovo Virtual Background application */
+};
+
+/* Options accepted after the keycode in the keymap sysfs attribute */
+static const struct {
+	const char *name;
+	u8 flag;
+} ideapad_wmi_key_options[] = {
+	{ "single_frame", IDEAPAD_WMI_KEY_SINGLE_FRAME },
+	{ "wakeup", IDEAPAD_WMI_KEY_WAKEUP },
+};
+
+/* nr_keys is at most U16_MAX, the firmware and sysfs formats cap it lower */
+static struct ideapad_wmi_keymap *ideapad_wmi_keymap_alloc(unsigned int nr_keys)
+{
+	unsigned int hash_bits = order_base_2(max(nr_keys, 1U) * 2);
+	struct ideapad_wmi_keymap *keymap;
+	size_t size = struct_size(keymap, keys, nr_keys);
+
+	ideapad_wmi_assert_cold();
+
+	/* The firmware format allows up to 65535 keys, about 1 MiB */
+	keymap = kvzalloc(size + (sizeof(*keymap->hash) << hash_bits),
+			  GFP_KERNEL);
+	if (!keymap)
+		return NULL;
+
+	keymap->hash = (u16 *)((u8 *)keymap + size);
+	keymap->hash_bits = hash_bits;
+
+	return keymap;
+}
+
+static struct ideapad_wmi_key *
+ideapad_wmi_keymap_lookup(struct ideapad_wmi_keymap *keymap, u32 scancode)
+{
+	unsigned int mask = (1U << keymap->hash_bits) - 1;
+	struct ideapad_wmi_key *key;
+	unsigned int i;
+
+	if (scancode < IDEAPAD_WMI_KEYMAP_INDEX_SIZE)
+		return keymap->index[scancode];
+
+	for (i = hash_32(scancode, keymap->hash_bits); keymap->hash[i];
+	     i = (i + 1) & mask) {
+		key = &keymap->keys[keymap->hash[i] - 1];
+		if (key->scancode == scancode)
+			return key;
+	}
+
+	return NULL;
+}
+
+static bool ideapad_wmi_keymap_has_keycode(const struct ideapad_wmi_keymap *keymap,
+					   unsigned int keycode)
+{
+	unsigned int i;
+
+	for (i = 0; i < keymap->nr_keys; i++) {
+		if (keymap->keys[i].type == KE_KEY &&
+		    keymap->keys[i].keycode == keycode)
+			return true;
+	}
+
+	return false;
+}
+
+/* Adds a key to a keymap that has not been published yet */
+static int ideapad_wmi_keymap_add(struct ideapad_wmi_keymap *keymap,
+				  const struct ideapad_wmi_key *key)
+{
+	unsigned int mask, i;
+
+	if (key->keycode > KEY_MAX)
+		return -EINVAL;
+
+	/* ideapad_wmi_debounce() only tracks scancodes in the index */
+	if (key->debounce_ms && key->scancode >= IDEAPAD_WMI_KEYMAP_INDEX_SIZE)
+		return -EINVAL;
+
+	if (ideapad_wmi_keymap_lookup(keymap, key->scancode))
+		return -EEXIST;
+
+	mask = (1U << keymap->hash_bits) - 1;
+
+	keymap->keys[keymap->nr_keys] = *key;
+	if (key->scancode < IDEAPAD_WMI_KEYMAP_INDEX_SIZE) {
+		keymap->index[key->scancode] = &keymap->keys[keymap->nr_keys];
+	} else {
+		/* Sized for nr_keys, a free slot always follows */
+		for (i = hash_32(key->scancode, keymap->hash_bits);
+		     keymap->hash[i]; i = (i + 1) & mask)
+			;
+		keymap->hash[i] = keymap->nr_keys + 1;
+	}
+	keymap->nr_keys++;
+
+	return 0;
+}
+
+static int ideapad_wmi_keymap_add_entries(struct ideapad_wmi_keymap *keymap,
+					  const struct key_entry *entries)
+{
+	const struct key_entry *entry;
+	struct ideapad_wmi_key key;
+	unsigned int i;
+	int err;
+
+	for (entry = entries; entry->type != KE_END; entry++) {
+		key = (struct ideapad_wmi_key) {
+			.scancode = entry->code,
+			.keycode = entry->type == KE_KEY ? entry->keycode : KEY_RESERVED,
+			.type = entry->type,
+		};
+
+		for (i = 0; i < ARRAY_SIZE(ideapad_wmi_single_frame_scancodes); i++) {
+			if (ideapad_wmi_single_frame_scancodes[i] == entry->code)
+				key.flags |= IDEAPAD_WMI_KEY_SINGLE_FRAME;
+		}
+
+		err = ideapad_wmi_keymap_add(keymap, &key);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+static struct ideapad_wmi_keymap *
+ideapad_wmi_keymap_create(const struct key_entry *const *keymaps)
+{
+	const struct key_entry *const *table;
+	const struct key_entry *entry;
+	struct ideapad_wmi_keymap *keymap;
+	unsigned int nr_keys = 0;
+	int err;
+
+	for (table = keymaps; *table; table++) {
+		for (entry = *table; entry->type != KE_END; entry++)
+			nr_keys++;
+	}
+
+	keymap = ideapad_wmi_keymap_alloc(nr_keys);
+	if (!keymap)
+		return ERR_PTR(-ENOMEM);
+
+	for (table = keymaps; *table; table++) {
+		err = ideapad_wmi_keymap_add_entries(keymap, *table);
+		if (err) {
+			kvfree(keymap);
+			return ERR_PTR(err);
+		}
+	}
+
+	return keymap;
+}
+
+static char *ideapad_wmi_next_token(char **line)
+{
+	char *token;
+
+	do {
+		token = strsep(line, " \t");
+	} while (token && !*token);
+
+	return token;
+}
+
+/*
+ * "<scancode> <keycode> [option...]", a keycode of 0 ignores the scancode.
+ * Besides the flags in ideapad_wmi_key_options "debounce=<ms>" sets a
+ * per-key debounce window, for scancodes below IDEAPAD_WMI_KEYMAP_INDEX_SIZE
+ * only.
+ */
+static int ideapad_wmi_keymap_parse_line(struct ideapad_wmi_keymap *keymap,
+					 char *line)
+{
+	struct ideapad_wmi_key key = { };
+	char *token;
+	unsigned int i;
+	int err;
+
+	token = ideapad_wmi_next_token(&line);
+	if (!token || *token == '#')
+		return 0;
+
+	err = kstrtou32(token, 0, &key.scancode);
+	if (err)
+		return err;
+
+	token = ideapad_wmi_next_token(&line);
+	if (!token)
+		return -EINVAL;
+
+	err = kstrtou16(token, 0, &key.keycode);
+	if (err)
+		return err;
+
+	key.type = key.keycode == KEY_RESERVED ? KE_IGNORE : KE_KEY;
+
+	while ((token = ideapad_wmi_next_token(&line))) {
+		if (str_has_prefix(token, "debounce=")) {
+			err = kstrtou16(token + strlen("debounce="), 0,
+					&key.debounce_ms);
+			if (err)
+				return err;
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_SIZE(ideapad_wmi_key_options); i++) {
+			if (!strcmp(token, ideapad_wmi_key_options[i].name))
+				break;
+		}
+		if (i == ARRAY_SIZE(ideapad_wmi_key_options))
+			return -EINVAL;
+
+		key.flags |= ideapad_wmi_key_options[i].flag;
+	}
+
+	return ideapad_wmi_keymap_add(keymap, &key);
+}
+
+static struct ideapad_wmi_keymap *ideapad_wmi_keymap_parse(const char *buf,
+							   size_t count)
+{
+	struct ideapad_wmi_keymap *keymap;
+	unsigned int nr_lines = 1;
+	char *copy, *cursor, *line;
+	size_t i;
+	int err = 0;
+
+	ideapad_wmi_assert_cold();
+
+	for (i = 0; i < count; i++) {
+		if (buf[i] == '\n')
+			nr_lines++;
+	}
+
+	copy = kstrndup(buf, count, GFP_KERNEL);
+	if (!copy)
+		return ERR_PTR(-ENOMEM);
+
+	keymap = ideapad_wmi_keymap_alloc(nr_lines);
+	if (!keymap) {
+		keymap = ERR_PTR(-ENOMEM);
+		goto out_free_copy;
+	}
+
+	cursor = copy;
+	while ((line = strsep(&cursor, "\n"))) {
+		err = ideapad_wmi_keymap_parse_line(keymap, line);
+		if (err)
+			break;
+	}
+
+	if (err) {
+		kvfree(keymap);
+		keymap = ERR_PTR(err);
+	}
+
+out_free_copy:
+	kfree(copy);
+	return keymap;
+}
+
+static void ideapad_wmi_keymap_set_keybits(struct input_dev *input_dev,
+					   const struct ideapad_wmi_keymap *keymap)
+{
+	unsigned int i;
+
+	for (i = 0; i < keymap->nr_keys; i++) {
+		if (keymap->keys[i].type == KE_KEY)
+			set_bit(keymap->keys[i].keycode, input_dev->keybit);
+	}
+	clear_bit(KEY_RESERVED, input_dev->keybit);
+}
+
+/* Clears the keycodes of @old that @keymap no longer reports */
+static void ideapad_wmi_keymap_clear_keybits(struct input_dev *input_dev,
+					     const struct ideapad_wmi_keymap *keymap,
+					     const struct ideapad_wmi_keymap *old)
+{
+	unsigned int keycode;
+	unsigned int i;
+
+	for (i = 0; i < old->nr_keys; i++) {
+		keycode = old->keys[i].keycode;
+		if (old->keys[i].type == KE_KEY && keycode != KEY_UNKNOWN &&
+		    !ideapad_wmi_keymap_has_keycode(keymap, keycode))
+			clear_bit(keycode, input_dev->keybit);
+	}
+}
+
+static bool ideapad_wmi_macros_has_keycode(const struct ideapad_wmi_macros *macros,
+					   unsigned int keycode)
+{
+	unsigned int i;
+
+	for (i = 0; macros && i < macros->nr_keys; i++) {
+		if ((macros->keys[i] & ~IDEAPAD_WMI_MACRO_CHORD) == keycode)
+			return true;
+	}
+
+	return false;
+}
+
+static void ideapad_wmi_macros_set_keybits(struct input_dev *input_dev,
+					   const struct ideapad_wmi_macros *macros)
+{
+	unsigned int i;
+
+	for (i = 0; macros && i < macros->nr_keys; i++)
+		set_bit(macros->keys[i] & ~IDEAPAD_WMI_MACRO_CHORD,
+			input_dev->keybit);
+}
+
+/* Clears the keycodes of @old that neither @macros nor @keymap report */
+static void ideapad_wmi_macros_clear_keybits(struct input_dev *input_dev,
+					     const struct ideapad_wmi_keymap *keymap,
+					     const struct ideapad_wmi_macros *macros,
+					     const struct ideapad_wmi_macros *old)
+{
+	unsigned int keycode;
+	unsigned int i;
+
+	for (i = 0; i < old->nr_keys; i++) {
+		keycode = old->keys[i] & ~IDEAPAD_WMI_MACRO_CHORD;
+		if (!ideapad_wmi_keymap_has_keycode(keymap, keycode) &&
+		    !ideapad_wmi_macros_has_keycode(macros, keycode))
+			clear_bit(keycode, input_dev->keybit);
+	}
+}
+
+/*
+ * "<scancode> <step> [step...]", where a step is a keycode or several joined
+ * by '+' that are pressed together.
+ */
+static int ideapad_wmi_macros_parse_line(struct ideapad_wmi_macros *macros,
+					 char *line)
+{
+	struct ideapad_wmi_macro *macro;
+	unsigned int i, chord;
+	char *token, *step;
+	u32 scancode;
+	u16 keycode;
+	int err;
+
+	token = ideapad_wmi_next_token(&line);
+	if (!token || *token == '#')
+		return 0;
+
+	err = kstrtou32(token, 0, &scancode);
+	if (err)
+		return err;
+
+	for (i = 0; i < macros->nr_macros; i++) {
+		if (macros->macros[i].scancode == scancode)
+			return -EINVAL;
+	}
+	if (macros->nr_macros == IDEAPAD_WMI_MAX_MACROS)
+		return -ENOSPC;
+
+	macro = &macros->macros[macros->nr_macros];
+	macro->scancode = scancode;
+	macro->start = macros->nr_keys;
+
+	while ((token = ideapad_wmi_next_token(&line))) {
+		chord = 0;
+		while ((step = strsep(&token, "+"))) {
+			err = kstrtou16(step, 0, &keycode);
+			if (err)
+				return err;
+			if (keycode == KEY_RESERVED || keycode > KEY_MAX)
+				return -EINVAL;
+			/* A chord is released at once, all of it in one frame */
+			if (++chord > IDEAPAD_WMI_MAX_BATCH)
+				return -EINVAL;
+			if (macros->nr_keys == IDEAPAD_WMI_MACRO_ARENA_SIZE)
+				return -ENOSPC;
+
+			if (token)
+				keycode |= IDEAPAD_WMI_MACRO_CHORD;
+			macros->keys[macros->nr_keys++] = keycode;
+		}
+	}
+
+	macro->len = macros->nr_keys - macro->start;
+	if (!macro->len)
+		return -EINVAL;
+
+	macros->nr_macros++;
+	return 0;
+}
+
+static int ideapad_wmi_macros_parse(struct ideapad_wmi_macros *macros,
+				    const char *buf, size_t count)
+{
+	char *copy, *cursor, *line;
+	int err = 0;
+
+	ideapad_wmi_assert_cold();
+
+	copy = kstrndup(buf, count, GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	macros->nr_macros = 0;
+	macros->nr_keys = 0;
+
+	cursor = copy;
+	while ((line = strsep(&cursor, "\n"))) {
+		err = ideapad_wmi_macros_parse_line(macros, line);
+		if (err)
+			break;
+	}
+
+	kfree(copy);
+	return err;
+}
+
+/* Same lookup sparse_keymap does, indices only count KE_KEY entries */
+static struct ideapad_wmi_key *
+ideapad_wmi_keymap_locate(struct ideapad_wmi_keymap *keymap,
+			  const struct input_keymap_entry *ke,
+			  unsigned int *index)
+{
+	struct ideapad_wmi_key *key;
+	unsigned int scancode;
+	unsigned int i, n = 0;
+	int err;
+
+	if (ke->flags & INPUT_KEYMAP_BY_INDEX) {
+		for (i = 0; i < keymap->nr_keys; i++) {
+			if (keymap->keys[i].type != KE_KEY)
+				continue;
+			if (n++ == ke->index) {
+				*index = ke->index;
+				return &keymap->keys[i];
+			}
+		}
+		return NULL;
+	}
+
+	err = input_scancode_to_scalar(ke, &scancode);
+	if (err)
+		return NULL;
+
+	key = ideapad_wmi_keymap_lookup(keymap, scancode);
+	if (!key || key->type != KE_KEY)
+		return NULL;
+
+	for (i = 0; &keymap->keys[i] != key; i++) {
+		if (keymap->keys[i].type == KE_KEY)
+			n++;
+	}
+	*index = n;
+
+	return key;
+}
+
+static int ideapad_wmi_getkeycode(struct input_dev *input_dev,
+				  struct input_keymap_entry *ke)
+{
+	struct ideapad_wmi_private *priv = input_get_drvdata(input_dev);
+	struct ideapad_wmi_keymap *keymap;
+	struct ideapad_wmi_key *key;
+	unsigned long flags;
+	unsigned int index;
+	int err = -EINVAL;
+
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+
+	keymap = rcu_dereference_protected(priv->keymap,
+					   lockdep_is_held(&priv->keymap_lock));
+	key = ideapad_wmi_keymap_locate(keymap, ke, &index);
+	if (key) {
+		ke->keycode = key->keycode;
+		ke->index = index;
+		ke->len = sizeof(key->scancode);
+		memcpy(ke->scancode, &key->scancode, sizeof(key->scancode));
+		err = 0;
+	}
+
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+	return err;
+}
+
+/* Called by the input core with the event lock held */
+static int ideapad_wmi_setkeycode(struct input_dev *input_dev,
+				  const struct input_keymap_entry *ke,
+				  unsigned int *old_keycode)
+{
+	struct ideapad_wmi_private *priv = input_get_drvdata(input_dev);
+	const struct ideapad_wmi_macros *macros;
+	struct ideapad_wmi_keymap *keymap;
+	struct ideapad_wmi_key *key;
+	unsigned long flags;
+	unsigned int index;
+	int err = -EINVAL;
+
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+
+	keymap = rcu_dereference_protected(priv->keymap,
+					   lockdep_is_held(&priv->keymap_lock));
+	macros = rcu_dereference_protected(priv->macros,
+					   lockdep_is_held(&priv->keymap_lock));
+	key = ideapad_wmi_keymap_locate(keymap, ke, &index);
+	if (key) {
+		*old_keycode = key->keycode;
+		WRITE_ONCE(key->keycode, ke->keycode);
+		set_bit(ke->keycode, input_dev->keybit);
+		/* Keep the keycode while it is still mapped or a macro emits it */
+		if (*old_keycode != KEY_UNKNOWN &&
+		    !ideapad_wmi_keymap_has_keycode(keymap, *old_keycode) &&
+		    !ideapad_wmi_macros_has_keycode(macros, *old_keycode))
+			clear_bit(*old_keycode, input_dev->keybit);
+		err = 0;
+	}
+
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+	return err;
+}
+
+static struct ideapad_wmi_keymap *
+ideapad_wmi_keymap_from_firmware(const struct firmware *fw)
+{
+	const struct ideapad_wmi_fw_header *header;
+	const struct ideapad_wmi_fw_key *fw_keys;
+	struct ideapad_wmi_keymap *keymap;
+	struct ideapad_wmi_key key;
+	unsigned int nr_keys, i;
+	int err;
+
+	if (fw->size < sizeof(*header))
+		return ERR_PTR(-EINVAL);
+
+	header = (const struct ideapad_wmi_fw_header *)fw->data;
+	if (le32_to_cpu(header->magic) != IDEAPAD_WMI_FW_MAGIC ||
+	    le16_to_cpu(header->version) != IDEAPAD_WMI_FW_VERSION)
+		return ERR_PTR(-EINVAL);
+
+	nr_keys = le16_to_cpu(header->nr_keys);
+	if (fw->size != sizeof(*header) + nr_keys * sizeof(*fw_keys))
+		return ERR_PTR(-EINVAL);
+
+	keymap = ideapad_wmi_keymap_alloc(nr_keys);
+	if (!keymap)
+		return ERR_PTR(-ENOMEM);
+
+	fw_keys = (const struct ideapad_wmi_fw_key *)(header + 1);
+	for (i = 0; i < nr_keys; i++) {
+		key = (struct ideapad_wmi_key) {
+			.scancode = le32_to_cpu(fw_keys[i].scancode),
+			.keycode = le16_to_cpu(fw_keys[i].keycode),
+			.type = fw_keys[i].type,
+			.flags = fw_keys[i].flags,
+			.debounce_ms = le16_to_cpu(fw_keys[i].debounce_ms),
+		};
+
+		if ((key.type != KE_KEY && key.type != KE_IGNORE) ||
+		    key.flags & ~IDEAPAD_WMI_KEY_FLAGS) {
+			err = -EINVAL;
+			goto err_free_keymap;
+		}
+
+		if (key.type == KE_IGNORE)
+			key.keycode = KEY_RESERVED;
+
+		err = ideapad_wmi_keymap_add(keymap, &key);
+		if (err)
+			goto err_free_keymap;
+	}
+
+	return keymap;
+
+err_free_keymap:
+	kvfree(keymap);
+	return ERR_PTR(err);
+}
+
+/* Returns NULL if no usable keymap firmware is installed */
+static struct ideapad_wmi_keymap *
+ideapad_wmi_keymap_request(struct ideapad_wmi_private *priv)
+{
+	struct ideapad_wmi_keymap *keymap;
+	const struct firmware *fw;
+	int err;
+
+	if (!keymap_firmware || !*keymap_firmware)
+		return NULL;
+
+	/* No usermode helper fallback, a missing file must not stall probe */
+	err = request_firmware_direct(&fw, keymap_firmware,
+				      &priv->wmi_device->dev);
+	if (err)
+		return NULL;
+
+	keymap = ideapad_wmi_keymap_from_firmware(fw);
+	release_firmware(fw);
+
+	if (IS_ERR(keymap)) {
+		dev_warn(&priv->wmi_device->dev,
+			 "Ignoring invalid keymap firmware %s: %ld\n",
+			 keymap_firmware, PTR_ERR(keymap));
+		return NULL;
+	}
+
+	dev_info(&priv->wmi_device->dev, "Using keymap from %s\n",
+		 keymap_firmware);
+	return keymap;
+}
+
+static int ideapad_wmi_keymap_init(struct ideapad_wmi_private *priv)
+{
+	struct ideapad_wmi_keymap *keymap;
+	int err;
+
+	ideapad_wmi_assert_cold();
+
+	keymap = ideapad_wmi_keymap_request(priv);
+	if (!keymap)
+		keymap = ideapad_wmi_keymap_create(ideapad_wmi_model_keymaps);
+	if (IS_ERR(keymap)) {
+		err = PTR_ERR(keymap);
+		dev_err(&priv->wmi_device->dev,
+			"Could not set up input device keymap: %d\n", err);
+		return err;
+	}
+
+	RCU_INIT_POINTER(priv->keymap, keymap);
+	return 0;
+}
+
+static void ideapad_wmi_keymap_exit(struct ideapad_wmi_private *priv)
+{
+	struct ideapad_wmi_keymap *keymap;
+
+	keymap = rcu_replace_pointer(priv->keymap, NULL, true);
+	kvfree_rcu(keymap, rcu);
+}
+
+static int ideapad_wmi_input_init(struct ideapad_wmi_private *priv)
+{
+	struct ideapad_wmi_macros *macros;
+	struct ideapad_wmi_keymap *keymap;
+	struct input_dev *input_dev;
+	unsigned long flags;
+	int err;
+
+	ideapad_wmi_assert_cold();
+
+	input_dev = input_allocate_device();
+	if (!input_dev) {
+		return -ENOMEM;
+	}
+
+	input_dev->name = "Ideapad WMI Fn Keys";
+	input_dev->phys = IDEAPAD_FN_KEY_EVENT_GUID "/input0";
+	input_dev->id.bustype = BUS_HOST;
+	input_dev->dev.parent = &priv->wmi_device->dev;
+	input_dev->getkeycode = ideapad_wmi_getkeycode;
+	input_dev->setkeycode = ideapad_wmi_setkeycode;
+	input_set_drvdata(input_dev, priv);
+
+	__set_bit(EV_KEY, input_dev->evbit);
+	__set_bit(EV_MSC, input_dev->evbit);
+	__set_bit(MSC_SCAN, input_dev->mscbit);
+	__set_bit(KEY_UNKNOWN, input_dev->keybit);
+
+	/* The keymap may have been replaced through sysfs in the meantime */
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	keymap = rcu_dereference_protected(priv->keymap,
+					   lockdep_is_held(&priv->keymap_lock));
+	ideapad_wmi_keymap_set_keybits(input_dev, keymap);
+	macros = rcu_dereference_protected(priv->macros,
+					   lockdep_is_held(&priv->keymap_lock));
+	ideapad_wmi_macros_set_keybits(input_dev, macros);
+	priv->input_dev = input_dev;
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+	err = input_register_device(input_dev);
+	if (err) {
+		dev_err(&priv->wmi_device->dev,
+			"Could not register input device: %d\n", err);
+		goto err_free_dev;
+	}
+
+	return 0;
+
+err_free_dev:
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	priv->input_dev = NULL;
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+	input_free_device(input_dev);
+	return err;
+}
+
+static void ideapad_wmi_input_exit(struct ideapad_wmi_private *priv)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->pending_lock, flags);
+	RCU_INIT_POINTER(priv->event_dev, NULL);
+	spin_unlock_irqrestore(&priv->pending_lock, flags);
+
+	/* Let events still reporting through the device finish */
+	synchronize_rcu();
+
+	input_unregister_device(priv->input_dev);
+
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	priv->input_dev = NULL;
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+}
+
+/* Syncs the pressed keys, then releases the held ones in a second frame */
+static void ideapad_wmi_frame_flush(struct ideapad_wmi_frame *frame)
+{
+	unsigned int i;
+
+	if (!frame->pending)
+		return;
+
+	input_sync(frame->input_dev);
+	frame->pending = false;
+
+	if (!frame->nr_release)
+		return;
+
+	for (i = 0; i < frame->nr_release; i++)
+		input_report_key(frame->input_dev, frame->release[i], 0);
+	input_sync(frame->input_dev);
+
+	frame->nr_release = 0;
+}
+
+/*
+ * Same events sparse_keymap_report_entry() emits, but the frame is only
+ * synced once all scancodes of a WMI event have been added to it.
+ */
+static void ideapad_wmi_frame_press(struct ideapad_wmi_frame *frame,
+				    unsigned int scancode, unsigned int keycode,
+				    bool single_frame)
+{
+	unsigned int i;
+
+	/* A held key can only be pressed once per frame */
+	if (!single_frame) {
+		for (i = 0; i < frame->nr_release; i++) {
+			if (frame->release[i] == keycode)
+				break;
+		}
+		if (i < frame->nr_release ||
+		    frame->nr_release == IDEAPAD_WMI_MAX_BATCH)
+			ideapad_wmi_frame_flush(frame);
+	}
+
+	input_event(frame->input_dev, EV_MSC, MSC_SCAN, scancode);
+	input_report_key(frame->input_dev, keycode, 1);
+	frame->pending = true;
+
+	if (single_frame)
+		input_report_key(frame->input_dev, keycode, 0);
+	else
+		frame->release[frame->nr_release++] = keycode;
+}
+
+/*
+ * Only the first occurrence of every scancode and a periodic summary hit
+ * the log, the full picture is available in debugfs. Logging is left to
+ * ideapad_wmi_log_work().
+ */
+static void ideapad_wmi_account_unknown(struct ideapad_wmi_private *priv,
+					unsigned int scancode)
+{
+	struct ideapad_wmi_unknown_stats *unknown = &priv->unknown;
+
+	if (scancode < IDEAPAD_WMI_UNKNOWN_HIST_SIZE) {
+		atomic_inc(&unknown->hist[scancode]);
+		if (!test_and_set_bit(scancode, unknown->seen)) {
+			set_bit(scancode, unknown->unlogged);
+			mod_delayed_work(system_wq, &priv->log_work, 0);
+			return;
+		}
+	} else {
+		atomic_inc(&unknown->overflow);
+	}
+
+	atomic_inc(&unknown->pending);
+	schedule_delayed_work(&priv->log_work,
+			      IDEAPAD_WMI_UNKNOWN_SUMMARY_INTERVAL);
+}
+
+static void ideapad_wmi_log_work(struct work_struct *work)
+{
+	struct ideapad_wmi_private *priv =
+		container_of(to_delayed_work(work), struct ideapad_wmi_private,
+			     log_work);
+	struct ideapad_wmi_unknown_stats *unknown = &priv->unknown;
+	struct device *dev = &READ_ONCE(priv->wmi_device)->dev;
+	unsigned int scancode;
+	u32 type;
+
+	type = xchg(&unknown->unsupported_type, 0);
+	if (type)
+		dev_warn(dev, "Unsupported WMI event data type %u\n", type);
+
+	for_each_set_bit(scancode, unknown->unlogged,
+			 IDEAPAD_WMI_UNKNOWN_HIST_SIZE) {
+		if (test_and_clear_bit(scancode, unknown->unlogged))
+			dev_info(dev, "Unknown scancode %#x\n", scancode);
+	}
+
+	if (!atomic_read(&unknown->pending))
+		return;
+
+	if (__ratelimit(&unknown->summary_rs))
+		dev_info(dev, "%d unknown scancode events since last report\n",
+			 atomic_xchg(&unknown->pending, 0));
+	else
+		schedule_delayed_work(&priv->log_work,
+				      IDEAPAD_WMI_UNKNOWN_SUMMARY_INTERVAL);
+}
+
+/*
+ * Some ECs fire the same scancode several times within a few milliseconds,
+ * drop those repeats before they reach the input core. Only scancodes
+ * covered by the keymap index are debounced, a per-key window for any other
+ * is rejected by ideapad_wmi_keymap_add().
+ */
+static bool ideapad_wmi_debounce(struct ideapad_wmi_private *priv,
+				 const struct ideapad_wmi_key *key)
+{
+	unsigned int window_ms = key->debounce_ms ?: READ_ONCE(debounce_ms);
+	u64 now, last;
+
+	if (!window_ms || key->scancode >= IDEAPAD_WMI_KEYMAP_INDEX_SIZE)
+		return false;
+
+	now = ktime_get_mono_fast_ns();
+	last = READ_ONCE(priv->last_event_ns[key->scancode]);
+	if (last && now - last < (u64)window_ms * NSEC_PER_MSEC)
+		return true;
+
+	WRITE_ONCE(priv->last_event_ns[key->scancode], now);
+	return false;
+}
+
+static void ideapad_wmi_ring_release(struct kref *kref)
+{
+	struct ideapad_wmi_ring *ring =
+		container_of(kref, struct ideapad_wmi_ring, kref);
+
+	vfree(ring->header);
+	kfree(ring);
+}
+
+static void ideapad_wmi_ring_push(struct ideapad_wmi_ring *ring,
+				  unsigned int scancode, unsigned int keycode)
+{
+	struct ideapad_wmi_ring_record *record;
+	unsigned long flags;
+	u64 head;
+
+	spin_lock_irqsave(&ring->lock, flags);
+
+	head = ring->header->head;
+	record = &ring->records[head & (IDEAPAD_WMI_RING_RECORDS - 1)];
+	/*
+	 * Overwrites record head - IDEAPAD_WMI_RING_RECORDS, make head visible
+	 * before that so readers re-checking it notice. Pairs with the read
+	 * barrier readers issue between copying a record and re-reading head.
+	 */
+	smp_wmb();
+	record->timestamp_ns = ktime_get_ns();
+	record->scancode = scancode;
+	record->keycode = keycode;
+	smp_store_release(&ring->header->head, head + 1);
+
+	spin_unlock_irqrestore(&ring->lock, flags);
+}
+
+/* Called once per WMI event, so readers wake up once per batch */
+static void ideapad_wmi_ring_wake(struct ideapad_wmi_ring *ring)
+{
+	u64 head = READ_ONCE(ring->header->head);
+
+	if (head == READ_ONCE(ring->woken))
+		return;
+
+	WRITE_ONCE(ring->woken, head);
+	if (wq_has_sleeper(&ring->wait))
+		wake_up_interruptible_poll(&ring->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+static bool ideapad_wmi_ring_pending(struct ideapad_wmi_ring_reader *reader)
+{
+	return smp_load_acquire(&reader->ring->header->head) != reader->seen;
+}
+
+static int ideapad_wmi_ring_open(struct inode *inode, struct file *file)
+{
+	struct ideapad_wmi_ring *ring =
+		container_of(file->private_data, struct ideapad_wmi_ring, misc);
+	struct ideapad_wmi_ring_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	kref_get(&ring->kref);
+	reader->ring = ring;
+	reader->seen = smp_load_acquire(&ring->header->head);
+	file->private_data = reader;
+
+	return 0;
+}
+
+static int ideapad_wmi_ring_file_release(struct inode *inode,
+					 struct file *file)
+{
+	struct ideapad_wmi_ring_reader *reader = file->private_data;
+
+	kref_put(&reader->ring->kref, ideapad_wmi_ring_release);
+	kfree(reader);
+
+	return 0;
+}
+
+static ssize_t ideapad_wmi_ring_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct ideapad_wmi_ring_reader *reader = file->private_data;
+	struct ideapad_wmi_ring *ring = reader->ring;
+	u64 head;
+	int err;
+
+	if (count < sizeof(head))
+		return -EINVAL;
+
+	if (!ideapad_wmi_ring_pending(reader)) {
+		if (READ_ONCE(ring->dead))
+			return 0;
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(ring->wait,
+					       ideapad_wmi_ring_pending(reader) ||
+					       READ_ONCE(ring->dead));
+		if (err)
+			return err;
+	}
+
+	head = smp_load_acquire(&ring->header->head);
+	if (head == reader->seen)
+		return 0;
+
+	if (copy_to_user(buf, &head, sizeof(head)))
+		return -EFAULT;
+
+	reader->seen = head;
+	return sizeof(head);
+}
+
+static __poll_t ideapad_wmi_ring_poll(struct file *file, poll_table *wait)
+{
+	struct ideapad_wmi_ring_reader *reader = file->private_data;
+	struct ideapad_wmi_ring *ring = reader->ring;
+	__poll_t mask = 0;
+
+	poll_wait(file, &ring->wait, wait);
+
+	if (ideapad_wmi_ring_pending(reader))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (READ_ONCE(ring->dead))
+		mask |= EPOLLHUP;
+
+	return mask;
+}
+
+/* The mapping is read-only, only the kernel advances head */
+static int ideapad_wmi_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct ideapad_wmi_ring_reader *reader = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+	return remap_vmalloc_range(vma, reader->ring->header, vma->vm_pgoff);
+}
+
+static const struct file_operations ideapad_wmi_ring_fops = {
+	.owner = THIS_MODULE,
+	.open = ideapad_wmi_ring_open,
+	.release = ideapad_wmi_ring_file_release,
+	.read = ideapad_wmi_ring_read,
+	.poll = ideapad_wmi_ring_poll,
+	.mmap = ideapad_wmi_ring_mmap,
+	.llseek = noop_llseek,
+};
+
+static int ideapad_wmi_ring_init(struct ideapad_wmi_private *priv)
+{
+	struct ideapad_wmi_ring *ring;
+	int err;
+
+	ideapad_wmi_assert_cold();
+
+	if (!event_ring)
+		return 0;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->header = vmalloc_user((1 + IDEAPAD_WMI_RING_DATA_PAGES) * PAGE_SIZE);
+	if (!ring->header) {
+		kfree(ring);
+		return -ENOMEM;
+	}
+
+	ring->records = (void *)ring->header + PAGE_SIZE;
+	ring->header->version = IDEAPAD_WMI_RING_VERSION;
+	ring->header->record_size = sizeof(*ring->records);
+	ring->header->nr_records = IDEAPAD_WMI_RING_RECORDS;
+	ring->header->data_offset = PAGE_SIZE;
+
+	kref_init(&ring->kref);
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+
+	ring->misc.minor = MISC_DYNAMIC_MINOR;
+	ring->misc.name = "ideapad-wmi-fn-keys";
+	ring->misc.fops = &ideapad_wmi_ring_fops;
+	ring->misc.parent = &priv->wmi_device->dev;
+	ring->misc.mode = 0400;
+
+	err = misc_register(&ring->misc);
+	if (err) {
+		dev_err(&priv->wmi_device->dev,
+			"Could not register event ring device: %d\n", err);
+		kref_put(&ring->kref, ideapad_wmi_ring_release);
+		return err;
+	}
+
+	priv->ring = ring;
+	return 0;
+}
+
+/* Open files keep the ring around, wake them up to notice it is gone */
+static void ideapad_wmi_ring_exit(struct ideapad_wmi_private *priv)
+{
+	struct ideapad_wmi_ring *ring = priv->ring;
+
+	if (!ring)
+		return;
+
+	misc_deregister(&ring->misc);
+	priv->ring = NULL;
+
+	WRITE_ONCE(ring->dead, true);
+	wake_up_interruptible_poll(&ring->wait, EPOLLHUP);
+	kref_put(&ring->kref, ideapad_wmi_ring_release);
+}
+
+static void ideapad_wmi_fn_lock_work(struct work_struct *work)
+{
+	struct ideapad_wmi_private *priv =
+		container_of(work, struct ideapad_wmi_private, fn_lock_work);
+	struct ideapad_wmi_instance *instance;
+
+	/* Every instance has its own fn_lock attribute */
+	mutex_lock(&priv->instances_lock);
+	list_for_each_entry(instance, &priv->instances, node)
+		sysfs_notify(&instance->wdev->dev.kobj, NULL, "fn_lock");
+	mutex_unlock(&priv->instances_lock);
+}
+
+/* Tracked by scancode, whatever the keymap maps it to */
+static void ideapad_wmi_fn_lock_update(struct ideapad_wmi_private *priv,
+				       unsigned int scancode)
+{
+	if (scancode != IDEAPAD_WMI_FN_LOCK_OFF &&
+	    scancode != IDEAPAD_WMI_FN_LOCK_ON)
+		return;
+
+	if (xchg(&priv->fn_lock, scancode) != scancode)
+		schedule_work(&priv->fn_lock_work);
+}
+
+/*
+ * Lets another driver, such as ideapad-laptop, report our keys through its
+ * own input device. Callbacks run in atomic context for every key press.
+ */
+int ideapad_wmi_fn_keys_register_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&ideapad_wmi_fn_keys_chain, nb);
+}
+#ifndef IDEAPAD_WMI_KUNIT
+EXPORT_SYMBOL_GPL(ideapad_wmi_fn_keys_register_notifier);
+#endif
+
+int ideapad_wmi_fn_keys_unregister_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&ideapad_wmi_fn_keys_chain, nb);
+}
+#ifndef IDEAPAD_WMI_KUNIT
+EXPORT_SYMBOL_GPL(ideapad_wmi_fn_keys_unregister_notifier);
+#endif
+
+static void ideapad_wmi_key_press(struct ideapad_wmi_private *priv,
+				  struct ideapad_wmi_frame *frame,
+				  unsigned int scancode, unsigned int keycode,
+				  bool single_frame)
+{
+	struct ideapad_wmi_fn_key key = {
+		.scancode = scancode,
+		.keycode = keycode,
+	};
+
+	trace_ideapad_wmi_report(scancode, keycode);
+	if (priv->ring)
+		ideapad_wmi_ring_push(priv->ring, scancode, keycode);
+	atomic_notifier_call_chain(&ideapad_wmi_fn_keys_chain, keycode, &key);
+
+	/* Without input_device, the notifier is the only consumer */
+	if (frame->input_dev)
+		ideapad_wmi_frame_press(frame, scancode, keycode, single_frame);
+}
+
+static void ideapad_wmi_count_key(struct ideapad_wmi_private *priv,
+				  unsigned int scancode)
+{
+	if (scancode < IDEAPAD_WMI_KEYMAP_INDEX_SIZE)
+		this_cpu_inc(priv->stats->key_events[scancode]);
+	else
+		this_cpu_inc(priv->stats->key_events_other);
+}
+
+/* Every step of the sequence gets a frame of its own */
+static bool ideapad_wmi_macro_report(struct ideapad_wmi_private *priv,
+				     const struct ideapad_wmi_macros *macros,
+				     struct ideapad_wmi_frame *frame,
+				     unsigned int scancode)
+{
+	const struct ideapad_wmi_macro *macro;
+	unsigned int i;
+	u16 key;
+
+	for (i = 0; i < macros->nr_macros; i++) {
+		if (macros->macros[i].scancode == scancode)
+			break;
+	}
+	if (i == macros->nr_macros)
+		return false;
+
+	macro = &macros->macros[i];
+	ideapad_wmi_count_key(priv, scancode);
+	ideapad_wmi_frame_flush(frame);
+	for (i = macro->start; i < macro->start + macro->len; i++) {
+		key = macros->keys[i];
+		ideapad_wmi_key_press(priv, frame, scancode,
+				      key & ~IDEAPAD_WMI_MACRO_CHORD, false);
+		if (!(key & IDEAPAD_WMI_MACRO_CHORD))
+			ideapad_wmi_frame_flush(frame);
+	}
+
+	return true;
+}
+
+/* Must be called within an RCU read-side critical section */
+static void ideapad_wmi_input_report_key(struct ideapad_wmi_private *priv,
+					 struct ideapad_wmi_frame *frame,
+					 unsigned int scancode)
+{
+	const struct ideapad_wmi_macros *macros = rcu_dereference(priv->macros);
+	const struct ideapad_wmi_key *key;
+	unsigned int keycode;
+
+	if (unlikely(macros) &&
+	    ideapad_wmi_macro_report(priv, macros, frame, scancode))
+		return;
+
+	key = ideapad_wmi_keymap_lookup(rcu_dereference(priv->keymap), scancode);
+	if (!key) {
+		ideapad_wmi_key_press(priv, frame, scancode, KEY_UNKNOWN, false);
+		this_cpu_inc(priv->stats->unknown);
+		ideapad_wmi_account_unknown(priv, scancode);
+		return;
+	}
+
+	if (ideapad_wmi_debounce(priv, key)) {
+		trace_ideapad_wmi_drop(scancode, IDEAPAD_WMI_DROP_DEBOUNCED);
+		this_cpu_inc(priv->stats->debounced);
+		return;
+	}
+
+	ideapad_wmi_count_key(priv, scancode);
+
+	if (key->type == KE_IGNORE) {
+		trace_ideapad_wmi_drop(scancode, IDEAPAD_WMI_DROP_IGNORED);
+		this_cpu_inc(priv->stats->ignored);
+		return;
+	}
+
+	keycode = READ_ONCE(key->keycode);
+	ideapad_wmi_key_press(priv, frame, scancode, keycode,
+			      key->flags & IDEAPAD_WMI_KEY_SINGLE_FRAME);
+}
+
+/*
+ * With bpf_filter set, every scancode is passed to ideapad_wmi_bpf_filter()
+ * before the keymap lookup. An fmod_ret program attached to it may rewrite
+ * the scancodes through ideapad_wmi_bpf_get_scancodes() and chooses what is
+ * reported with its return value: a negative errno drops the scancode, 0
+ * reports scancodes[0] and n > 0 the first n scancodes.
+ */
+#define IDEAPAD_WMI_BPF_MAX_SCANCODES	8
+
+struct ideapad_wmi_bpf_ctx {
+	/* As received from the firmware */
+	u32 scancode;
+	u32 scancodes[IDEAPAD_WMI_BPF_MAX_SCANCODES];
+};
+
+#ifdef IDEAPAD_WMI_BPF
+__bpf_hook_start();
+
+/*
+ * __weak like the HID-BPF hooks, so that the compiler cannot derive from the
+ * empty body that *ctx is left untouched and reuse the scancodes it cached
+ * before the call.
+ */
+__weak noinline int ideapad_wmi_bpf_filter(struct ideapad_wmi_bpf_ctx *ctx)
+{
+	return 0;
+}
+ALLOW_ERROR_INJECTION(ideapad_wmi_bpf_filter, ERRNO);
+
+__bpf_hook_end();
+
+__bpf_kfunc_start_defs();
+
+/* rdwr_buf_size tells the verifier how much of the array the program uses */
+__bpf_kfunc u32 *ideapad_wmi_bpf_get_scancodes(struct ideapad_wmi_bpf_ctx *ctx,
+					       const size_t rdwr_buf_size)
+{
+	if (rdwr_buf_size > sizeof(ctx->scancodes))
+		return NULL;
+
+	return ctx->scancodes;
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(ideapad_wmi_bpf_kfunc_ids)
+BTF_ID_FLAGS(func, ideapad_wmi_bpf_get_scancodes, KF_RET_NULL)
+BTF_KFUNCS_END(ideapad_wmi_bpf_kfunc_ids)
+
+static const struct btf_kfunc_id_set ideapad_wmi_bpf_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set = &ideapad_wmi_bpf_kfunc_ids,
+};
+
+static int ideapad_wmi_bpf_init(void)
+{
+	return register_btf_kfunc_id_set(BPF_PROG_TYPE_TRACING,
+					 &ideapad_wmi_bpf_kfunc_set);
+}
+
+static bool ideapad_wmi_bpf_active(void)
+{
+	return static_branch_unlikely(&ideapad_wmi_bpf_enabled);
+}
+#else
+static int ideapad_wmi_bpf_filter(struct ideapad_wmi_bpf_ctx *ctx)
+{
+	return 0;
+}
+
+static int ideapad_wmi_bpf_init(void)
+{
+	return 0;
+}
+
+static bool ideapad_wmi_bpf_active(void)
+{
+	return false;
+}
+#endif
+
+static void ideapad_wmi_bpf_report(struct ideapad_wmi_private *priv,
+				   struct ideapad_wmi_frame *frame,
+				   unsigned int scancode)
+{
+	struct ideapad_wmi_bpf_ctx ctx = {
+		.scancode = scancode,
+		.scancodes = { scancode },
+	};
+	int i, nr;
+
+	nr = ideapad_wmi_bpf_filter(&ctx);
+	if (nr < 0) {
+		trace_ideapad_wmi_drop(scancode, IDEAPAD_WMI_DROP_FILTERED);
+		this_cpu_inc(priv->stats->filtered);
+		return;
+	}
+
+	nr = clamp(nr, 1, IDEAPAD_WMI_BPF_MAX_SCANCODES);
+	for (i = 0; i < nr; i++)
+		ideapad_wmi_input_report_key(priv, frame, ctx.scancodes[i]);
+}
+
+/* Must be called within an RCU read-side critical section */
+static void ideapad_wmi_input_report_filtered(struct ideapad_wmi_private *priv,
+					      struct ideapad_wmi_frame *frame,
+					      unsigned int scancode)
+{
+	if (ideapad_wmi_bpf_active())
+		ideapad_wmi_bpf_report(priv, frame, scancode);
+	else
+		ideapad_wmi_input_report_key(priv, frame, scancode);
+}
+
+/*
+ * Queues the event if the input device is not published yet, or drops it
+ * if registering the input device failed. Returns the input device instead
+ * if it got published in the meantime.
+ */
+static struct input_dev *
+ideapad_wmi_queue_pending(struct ideapad_wmi_private *priv,
+			  const struct ideapad_wmi_event *event)
+{
+	struct input_dev *input_dev;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&priv->pending_lock, flags);
+
+	input_dev = rcu_dereference(priv->event_dev);
+	for (i = 0; !input_dev && i < event->nr_scancodes; i++) {
+		if (priv->input_err ||
+		    !kfifo_put(&priv->pending, event->scancodes[i])) {
+			trace_ideapad_wmi_drop(event->scancodes[i],
+					       IDEAPAD_WMI_DROP_NOT_READY);
+			this_cpu_inc(priv->stats->dropped);
+		}
+	}
+
+	spin_unlock_irqrestore(&priv->pending_lock, flags);
+
+	return input_dev;
+}
+
+/*
+ * Like ideapad_wmi_queue_pending() for the star key press of an expired
+ * long-press timer, which must not go through the long-press stage again.
+ */
+static struct input_dev *
+ideapad_wmi_queue_star_key(struct ideapad_wmi_private *priv)
+{
+	struct input_dev *input_dev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->pending_lock, flags);
+
+	input_dev = rcu_dereference(priv->event_dev);
+	if (!input_dev) {
+		if (priv->input_err || priv->star_key_pending) {
+			trace_ideapad_wmi_drop(IDEAPAD_WMI_STAR_KEY,
+					       IDEAPAD_WMI_DROP_NOT_READY);
+			this_cpu_inc(priv->stats->dropped);
+		} else {
+			priv->star_key_pending = true;
+		}
+	}
+
+	spin_unlock_irqrestore(&priv->pending_lock, flags);
+
+	return input_dev;
+}
+
+/* No long-press followed the star key in time, report the short press */
+static enum hrtimer_restart ideapad_wmi_long_press_expired(struct hrtimer *timer)
+{
+	struct ideapad_wmi_private *priv =
+		container_of(timer, struct ideapad_wmi_private, long_press_timer);
+	struct ideapad_wmi_frame frame = { };
+
+	rcu_read_lock();
+
+	frame.input_dev = rcu_dereference(priv->event_dev);
+	if (unlikely(!frame.input_dev) && input_device)
+		frame.input_dev = ideapad_wmi_queue_star_key(priv);
+
+	if (frame.input_dev || !input_device) {
+		ideapad_wmi_input_report_filtered(priv, &frame,
+						  IDEAPAD_WMI_STAR_KEY);
+		ideapad_wmi_frame_flush(&frame);
+		if (priv->ring)
+			ideapad_wmi_ring_wake(priv->ring);
+	}
+
+	rcu_read_unlock();
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * The firmware sends no release, only the long-press once its own timeout
+ * expired. Holding back the short press until long_press_ms passed reports
+ * either one of the two keys instead of both. Returns true if the scancode
+ * was held back.
+ */
+static bool ideapad_wmi_long_press(struct ideapad_wmi_private *priv,
+				   struct ideapad_wmi_frame *frame,
+				   unsigned int scancode)
+{
+	unsigned int ms = READ_ONCE(long_press_ms);
+	bool held;
+
+	if (scancode != IDEAPAD_WMI_STAR_KEY &&
+	    scancode != IDEAPAD_WMI_STAR_KEY_LONG)
+		return false;
+
+	/* A press still held back is dropped by a long-press, or reported */
+	held = hrtimer_try_to_cancel(&priv->long_press_timer) == 1;
+	if (scancode == IDEAPAD_WMI_STAR_KEY_LONG) {
+		if (held) {
+			trace_ideapad_wmi_drop(IDEAPAD_WMI_STAR_KEY,
+					       IDEAPAD_WMI_DROP_LONG_PRESS);
+			this_cpu_inc(priv->stats->dropped);
+		}
+		return false;
+	}
+
+	if (held)
+		ideapad_wmi_input_report_filtered(priv, frame, scancode);
+	if (!ms)
+		return false;
+
+	hrtimer_start(&priv->long_press_timer, ms_to_ktime(ms),
+		      HRTIMER_MODE_REL_SOFT);
+	return true;
+}
+
+/* Must be called within an RCU read-side critical section */
+static void ideapad_wmi_input_report(struct ideapad_wmi_private *priv,
+				     struct ideapad_wmi_frame *frame,
+				     unsigned int scancode)
+{
+	/* FnLock follows the firmware, even for filtered scancodes */
+	ideapad_wmi_fn_lock_update(priv, scancode);
+
+	if (ideapad_wmi_long_press(priv, frame, scancode))
+		return;
+
+	ideapad_wmi_input_report_filtered(priv, frame, scancode);
+}
+
+static u64 ideapad_wmi_stats_sum(struct ideapad_wmi_private *priv,
+				 size_t offset)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((void *)per_cpu_ptr(priv->stats, cpu) + offset);
+
+	return sum;
+}
+
+#define ideapad_wmi_stats_read(priv, member) \
+	ideapad_wmi_stats_sum(priv, offsetof(struct ideapad_wmi_stats, member))
+
+static ssize_t key_events_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	struct ideapad_wmi_keymap *keymap;
+	unsigned int scancode;
+	int len = 0;
+
+	rcu_read_lock();
+	keymap = rcu_dereference(priv->keymap);
+	for (scancode = 0; scancode < IDEAPAD_WMI_KEYMAP_INDEX_SIZE; scancode++) {
+		if (!keymap->index[scancode])
+			continue;
+
+		len += sysfs_emit_at(buf, len, "%#04x %llu\n", scancode,
+				     ideapad_wmi_stats_read(priv, key_events[scancode]));
+	}
+	rcu_read_unlock();
+
+	len += sysfs_emit_at(buf, len, "other %llu\n",
+			     ideapad_wmi_stats_read(priv, key_events_other));
+	len += sysfs_emit_at(buf, len, "ignored %llu\n",
+			     ideapad_wmi_stats_read(priv, ignored));
+	len += sysfs_emit_at(buf, len, "debounced %llu\n",
+			     ideapad_wmi_stats_read(priv, debounced));
+	len += sysfs_emit_at(buf, len, "dropped %llu\n",
+			     ideapad_wmi_stats_read(priv, dropped));
+	len += sysfs_emit_at(buf, len, "filtered %llu\n",
+			     ideapad_wmi_stats_read(priv, filtered));
+
+	return len;
+}
+static DEVICE_ATTR_RO(key_events);
+
+/* Summing is racy against concurrent events, which is fine for statistics */
+static void ideapad_wmi_latency_sum(struct ideapad_wmi_private *priv,
+				    struct ideapad_wmi_latency_stats *sum)
+{
+	const struct ideapad_wmi_latency_stats *stats;
+	unsigned int bucket;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(priv->latency, cpu);
+		if (!stats->count)
+			continue;
+
+		for (bucket = 0; bucket < IDEAPAD_WMI_LATENCY_BUCKETS; bucket++)
+			sum->hist[bucket] += stats->hist[bucket];
+		if (!sum->count || stats->min_ns < sum->min_ns)
+			sum->min_ns = stats->min_ns;
+		sum->max_ns = max(sum->max_ns, stats->max_ns);
+		sum->sum_ns += stats->sum_ns;
+		sum->count += stats->count;
+	}
+}
+
+/*
+ * Summary for monitoring, read from the per-CPU counters in one pass. The
+ * latencies are only collected while latency_stats is set, last_event_ms is
+ * the time since the last notification or -1 before the first. input_error
+ * is the error registering the input device failed with, 0 otherwise.
+ */
+static ssize_t stats_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	struct ideapad_wmi_stats sum = { };
+	struct ideapad_wmi_latency_stats latency;
+	const struct ideapad_wmi_stats *stats;
+	unsigned long last_event = 0;
+	unsigned int scancode;
+	u64 key_events = 0;
+	int len = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(priv->stats, cpu);
+
+		for (scancode = 0; scancode < IDEAPAD_WMI_KEYMAP_INDEX_SIZE;
+		     scancode++)
+			key_events += stats->key_events[scancode];
+		key_events += stats->key_events_other;
+		sum.ignored += stats->ignored;
+		sum.unknown += stats->unknown;
+		sum.not_integer += stats->not_integer;
+		sum.debounced += stats->debounced;
+		sum.dropped += stats->dropped;
+		sum.filtered += stats->filtered;
+
+		if (stats->events &&
+		    (!sum.events || time_after(stats->last_event, last_event)))
+			last_event = stats->last_event;
+		sum.events += stats->events;
+	}
+
+	ideapad_wmi_latency_sum(priv, &latency);
+
+	len += sysfs_emit_at(buf, len, "events %llu\n", sum.events);
+	/* key_events counts ignored keys too */
+	len += sysfs_emit_at(buf, len, "mapped %llu\n", key_events - sum.ignored);
+	len += sysfs_emit_at(buf, len, "ignored %llu\n", sum.ignored);
+	len += sysfs_emit_at(buf, len, "unknown %llu\n", sum.unknown);
+	len += sysfs_emit_at(buf, len, "not_integer %llu\n", sum.not_integer);
+	len += sysfs_emit_at(buf, len, "debounced %llu\n", sum.debounced);
+	len += sysfs_emit_at(buf, len, "dropped %llu\n", sum.dropped);
+	len += sysfs_emit_at(buf, len, "filtered %llu\n", sum.filtered);
+	len += sysfs_emit_at(buf, len, "latency_max_ns %llu\n", latency.max_ns);
+	len += sysfs_emit_at(buf, len, "latency_avg_ns %llu\n",
+			     latency.count ?
+			     div64_u64(latency.sum_ns, latency.count) : 0);
+	if (sum.events)
+		len += sysfs_emit_at(buf, len, "last_event_ms %u\n",
+				     jiffies_to_msecs(jiffies - last_event));
+	else
+		len += sysfs_emit_at(buf, len, "last_event_ms -1\n");
+	len += sysfs_emit_at(buf, len, "input_error %d\n",
+			     READ_ONCE(priv->input_err));
+
+	return len;
+}
+static DEVICE_ATTR_RO(stats);
+
+static ssize_t keymap_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	const struct ideapad_wmi_keymap *keymap;
+	const struct ideapad_wmi_key *key;
+	unsigned int i, j;
+	int len = 0;
+
+	rcu_read_lock();
+	keymap = rcu_dereference(priv->keymap);
+	for (i = 0; i < keymap->nr_keys; i++) {
+		key = &keymap->keys[i];
+		len += sysfs_emit_at(buf, len, "%#04x %u", key->scancode,
+				     READ_ONCE(key->keycode));
+		for (j = 0; j < ARRAY_SIZE(ideapad_wmi_key_options); j++) {
+			if (key->flags & ideapad_wmi_key_options[j].flag)
+				len += sysfs_emit_at(buf, len, " %s",
+						     ideapad_wmi_key_options[j].name);
+		}
+		if (key->debounce_ms)
+			len += sysfs_emit_at(buf, len, " debounce=%u",
+					     key->debounce_ms);
+		len += sysfs_emit_at(buf, len, "\n");
+	}
+	rcu_read_unlock();
+
+	return len;
+}
+
+/* Replaces the whole keymap, see ideapad_wmi_keymap_parse_line() */
+static ssize_t keymap_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	struct ideapad_wmi_keymap *keymap, *old;
+	struct ideapad_wmi_macros *macros;
+	unsigned long flags;
+
+	keymap = ideapad_wmi_keymap_parse(buf, count);
+	if (IS_ERR(keymap))
+		return PTR_ERR(keymap);
+
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	old = rcu_replace_pointer(priv->keymap, keymap,
+				  lockdep_is_held(&priv->keymap_lock));
+	if (priv->input_dev)
+		ideapad_wmi_keymap_set_keybits(priv->input_dev, keymap);
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+	/* No event in flight can press a key of the old keymap after this */
+	synchronize_rcu();
+
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	keymap = rcu_dereference_protected(priv->keymap,
+					   lockdep_is_held(&priv->keymap_lock));
+	macros = rcu_dereference_protected(priv->macros,
+					   lockdep_is_held(&priv->keymap_lock));
+	if (priv->input_dev) {
+		ideapad_wmi_keymap_clear_keybits(priv->input_dev, keymap, old);
+		/* Keycodes still used by macros stay */
+		ideapad_wmi_macros_set_keybits(priv->input_dev, macros);
+	}
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+	kvfree(old);
+
+	return count;
+}
+static DEVICE_ATTR_RW(keymap);
+
+/* Served from the last FnLock event, pollable through sysfs_notify() */
+static ssize_t fn_lock_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	u32 fn_lock = READ_ONCE(priv->fn_lock);
+
+	if (!fn_lock)
+		return -ENODATA;
+
+	return sysfs_emit(buf, "%d\n", fn_lock == IDEAPAD_WMI_FN_LOCK_ON);
+}
+static DEVICE_ATTR_RO(fn_lock);
+
+static ssize_t macros_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	const struct ideapad_wmi_macros *macros;
+	const struct ideapad_wmi_macro *macro;
+	unsigned int i, j;
+	char sep;
+	int len = 0;
+
+	rcu_read_lock();
+	macros = rcu_dereference(priv->macros);
+	for (i = 0; macros && i < macros->nr_macros; i++) {
+		macro = &macros->macros[i];
+		len += sysfs_emit_at(buf, len, "%#04x", macro->scancode);
+		sep = ' ';
+		for (j = macro->start; j < macro->start + macro->len; j++) {
+			len += sysfs_emit_at(buf, len, "%c%u", sep,
+					     macros->keys[j] & ~IDEAPAD_WMI_MACRO_CHORD);
+			sep = macros->keys[j] & IDEAPAD_WMI_MACRO_CHORD ? '+' : ' ';
+		}
+		len += sysfs_emit_at(buf, len, "\n");
+	}
+	rcu_read_unlock();
+
+	return len;
+}
+
+/*
+ * Replaces all macros, see ideapad_wmi_macros_parse_line(). Parsing happens
+ * in the spare buffer, so reporting a macro never allocates.
+ */
+static ssize_t macros_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
+	struct ideapad_wmi_macros *spare, *macros, *old;
+	struct ideapad_wmi_keymap *keymap;
+	unsigned long flags;
+	int err;
+
+	mutex_lock(&priv->macro_lock);
+
+	spare = &priv->macro_arena[priv->macro_spare];
+	err = ideapad_wmi_macros_parse(spare, buf, count);
+	if (err)
+		goto out_unlock;
+
+	macros = spare->nr_macros ? spare : NULL;
+
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	old = rcu_replace_pointer(priv->macros, macros,
+				  lockdep_is_held(&priv->keymap_lock));
+	if (priv->input_dev)
+		ideapad_wmi_macros_set_keybits(priv->input_dev, macros);
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+	/* No event in flight uses the old buffer after this */
+	synchronize_rcu();
+	priv->macro_spare ^= 1;
+
+	if (!old)
+		goto out_unlock;
+
+	/* macros is stable, only this function replaces it */
+	spin_lock_irqsave(&priv->keymap_lock, flags);
+	keymap = rcu_dereference_protected(priv->keymap,
+					   lockdep_is_held(&priv->keymap_lock));
+	if (priv->input_dev)
+		ideapad_wmi_macros_clear_keybits(priv->input_dev, keymap,
+						 macros, old);
+	spin_unlock_irqrestore(&priv->keymap_lock, flags);
+
+out_unlock:
+	mutex_unlock(&priv->macro_lock);
+	if (err)
+		return err;
+
+	return count;
+}
+static DEVICE_ATTR_RW(macros);
+
+static struct attribute *ideapad_wmi_attrs[] = {
+	&dev_attr_key_events.attr,
+	&dev_attr_stats.attr,
+	&dev_attr_keymap.attr,
+	&dev_attr_fn_lock.attr,
+	&dev_attr_macros.attr,
+	NULL
+};
+ATTRIBUTE_GROUPS(ideapad_wmi);
+
+static ktime_t ideapad_wmi_latency_start(void)
+{
+	if (static_branch_unlikely(&ideapad_wmi_latency_enabled))
+		return ktime_get();
+
+	return 0;
+}
+
+static void ideapad_wmi_latency_record(struct ideapad_wmi_private *priv,
+				       ktime_t start)
+{
+	struct ideapad_wmi_latency_stats *stats;
+	unsigned int bucket;
+	u64 ns;
+
+	/* The key may have been flipped on while the event was in flight */
+	if (!start)
+		return;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	bucket = ns ? min_t(unsigned int, ilog2(ns),
+			    IDEAPAD_WMI_LATENCY_BUCKETS - 1) : 0;
+
+	stats = get_cpu_ptr(priv->latency);
+	stats->hist[bucket]++;
+	if (!stats->count || ns < stats->min_ns)
+		stats->min_ns = ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+	stats->sum_ns += ns;
+	stats->count++;
+	put_cpu_ptr(priv->latency);
+}
+
+static int ideapad_wmi_latency_show(struct seq_file *m, void *unused)
+{
+	struct ideapad_wmi_private *priv = m->private;
+	struct ideapad_wmi_latency_stats sum;
+	unsigned int bucket;
+	u64 seen = 0;
+	u64 p99_rank;
+	u64 p99_ns = 0;
+
+	ideapad_wmi_latency_sum(priv, &sum);
+
+	/* Upper bound of the bucket holding the 99th percentile */
+	p99_rank = DIV_ROUND_UP(sum.count * 99, 100);
+	for (bucket = 0; sum.count && bucket < IDEAPAD_WMI_LATENCY_BUCKETS; bucket++) {
+		seen += sum.hist[bucket];
+		if (seen >= p99_rank) {
+			p99_ns = bucket < IDEAPAD_WMI_LATENCY_BUCKETS - 1 ?
+				 BIT_ULL(bucket + 1) : sum.max_ns;
+			break;
+		}
+	}
+
+	seq_printf(m, "enabled: %d\n",
+		   static_key_enabled(&ideapad_wmi_latency_enabled));
+	seq_printf(m, "count: %llu\n", sum.count);
+	seq_printf(m, "min_ns: %llu\n", sum.min_ns);
+	seq_printf(m, "avg_ns: %llu\n",
+		   sum.count ? div64_u64(sum.sum_ns, sum.count) : 0);
+	seq_printf(m, "max_ns: %llu\n", sum.max_ns);
+	seq_printf(m, "p99_ns: %llu\n", p99_ns);
+
+	for (bucket = 0; bucket < IDEAPAD_WMI_LATENCY_BUCKETS; bucket++) {
+		if (sum.hist[bucket])
+			seq_printf(m, "%llu-%llu: %llu\n",
+				   bucket ? BIT_ULL(bucket) : 0,
+				   BIT_ULL(bucket + 1) - 1, sum.hist[bucket]);
+	}
+
+	return 0;
+}
+
+static int ideapad_wmi_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ideapad_wmi_latency_show, inode->i_private);
+}
+
+/* Any write resets the statistics */
+static ssize_t ideapad_wmi_latency_write(struct file *file,
+					 const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ideapad_wmi_private *priv = m->private;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(priv->latency, cpu), 0,
+		       sizeof(struct ideapad_wmi_latency_stats));
+
+	return count;
+}
+
+static const struct file_operations ideapad_wmi_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = ideapad_wmi_latency_open,
+	.read = seq_read,
+	.write = ideapad_wmi_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ideapad_wmi_event_add(struct ideapad_wmi_event *event, u32 scancode)
+{
+	if (event->nr_scancodes == ARRAY_SIZE(event->scancodes)) {
+		trace_ideapad_wmi_drop(scancode, IDEAPAD_WMI_DROP_OVERFLOW);
+		event->nr_dropped++;
+		return;
+	}
+
+	event->scancodes[event->nr_scancodes++] = scancode;
+}
+
+/* Buffers carry a sequence of little-endian 32-bit scancodes */
+static void ideapad_wmi_decode_buffer(struct ideapad_wmi_event *event,
+				      const u8 *buf, size_t length)
+{
+	size_t offset;
+
+	for (offset = 0; offset + sizeof(u32) <= length; offset += sizeof(u32))
+		ideapad_wmi_event_add(event, get_unaligned_le32(buf + offset));
+}
+
+/*
+ * Must be called within an RCU read-side critical section. A burst of
+ * wakeup keys only reports a single wakeup event per suspend.
+ */
+static void ideapad_wmi_suspended_event(struct ideapad_wmi_private *priv,
+					const struct ideapad_wmi_event *event)
+{
+	struct ideapad_wmi_keymap *keymap = rcu_dereference(priv->keymap);
+	const struct ideapad_wmi_key *key;
+	unsigned int i;
+
+	this_cpu_add(priv->stats->dropped, event->nr_scancodes);
+
+	for (i = 0; i < event->nr_scancodes; i++) {
+		trace_ideapad_wmi_drop(event->scancodes[i],
+				       IDEAPAD_WMI_DROP_SUSPENDED);
+
+		key = ideapad_wmi_keymap_lookup(keymap, event->scancodes[i]);
+		if (!key || !(key->flags & IDEAPAD_WMI_KEY_WAKEUP))
+			continue;
+
+		if (!test_and_set_bit(0, &priv->wakeup_pending))
+			pm_wakeup_hard_event(&READ_ONCE(priv->wmi_device)->dev);
+	}
+}
+
+/*
+ * Lock-free against remove, which unpublishes the input device and waits
+ * for an RCU grace period before unregistering it.
+ */
+static void ideapad_wmi_deliver_event(struct ideapad_wmi_private *priv,
+				      const struct ideapad_wmi_event *event,
+				      ktime_t start)
+{
+	struct ideapad_wmi_frame frame = { };
+	unsigned int i;
+
+	if (unlikely(event->nr_dropped))
+		this_cpu_add(priv->stats->dropped, event->nr_dropped);
+
+	rcu_read_lock();
+
+	if (unlikely(READ_ONCE(priv->suspended))) {
+		ideapad_wmi_suspended_event(priv, event);
+		goto out_unlock;
+	}
+
+	frame.input_dev = rcu_dereference(priv->event_dev);
+	if (unlikely(!frame.input_dev) && input_device) {
+		frame.input_dev = ideapad_wmi_queue_pending(priv, event);
+		if (!frame.input_dev)
+			goto out_unlock;
+	}
+
+	for (i = 0; i < event->nr_scancodes; i++)
+		ideapad_wmi_input_report(priv, &frame, event->scancodes[i]);
+	ideapad_wmi_frame_flush(&frame);
+	if (priv->ring)
+		ideapad_wmi_ring_wake(priv->ring);
+
+	if (static_branch_unlikely(&ideapad_wmi_latency_enabled))
+		ideapad_wmi_latency_record(priv, start);
+
+out_unlock:
+	rcu_read_unlock();
+}
+
+/* Drains the delivery fifo, one frame set per IDEAPAD_WMI_MAX_EVENT_SCANCODES */
+static void ideapad_wmi_delivery_work(struct work_struct *work)
+{
+	struct ideapad_wmi_private *priv =
+		container_of(work, struct ideapad_wmi_private, delivery_work);
+	struct ideapad_wmi_event event = { };
+	ktime_t start;
+
+	do {
+		start = READ_ONCE(priv->delivery_start);
+		event.nr_scancodes = kfifo_out(&priv->delivery, event.scancodes,
+					       ARRAY_SIZE(event.scancodes));
+		if (event.nr_scancodes) {
+			ideapad_wmi_hot_enter();
+			ideapad_wmi_deliver_event(priv, &event, start);
+			ideapad_wmi_hot_exit();
+		}
+	} while (event.nr_scancodes == ARRAY_SIZE(event.scancodes));
+}
+
+static void ideapad_wmi_defer_event(struct ideapad_wmi_private *priv,
+				    const struct ideapad_wmi_event *event,
+				    ktime_t start)
+{
+	unsigned int queued, dropped;
+	unsigned long flags;
+	int cpu;
+
+	spin_lock_irqsave(&priv->delivery_lock, flags);
+	if (kfifo_is_empty(&priv->delivery))
+		WRITE_ONCE(priv->delivery_start, start);
+	queued = kfifo_in(&priv->delivery, event->scancodes,
+			  event->nr_scancodes);
+	spin_unlock_irqrestore(&priv->delivery_lock, flags);
+
+	dropped = event->nr_dropped;
+	if (unlikely(queued < event->nr_scancodes)) {
+		trace_ideapad_wmi_drop(event->scancodes[queued],
+				       IDEAPAD_WMI_DROP_OVERFLOW);
+		dropped += event->nr_scancodes - queued;
+	}
+	if (unlikely(dropped))
+		this_cpu_add(priv->stats->dropped, dropped);
+
+	cpu = READ_ONCE(delivery_cpu);
+	if (cpu >= 0 && (unsigned int)cpu < nr_cpu_ids && cpu_online(cpu))
+		queue_work_on(cpu, priv->delivery_wq, &priv->delivery_work);
+	else
+		queue_work(priv->delivery_wq, &priv->delivery_work);
+}
+
+static void ideapad_wmi_handle_event(struct ideapad_wmi_private *priv,
+				     const struct ideapad_wmi_event *event,
+				     ktime_t start)
+{
+	if (priv->delivery_wq)
+		ideapad_wmi_defer_event(priv, event, start);
+	else
+		ideapad_wmi_deliver_event(priv, event, start);
+}
+
+/*
+ * Reserves a slot by bumping the head and marks it complete once filled, so
+ * concurrent events never wait on each other. Readers skip records that were
+ * overwritten while they were being copied.
+ */
+static void ideapad_wmi_record(struct ideapad_wmi_private *priv, u32 type,
+			       const void *data, size_t length)
+{
+	u64 pos = atomic64_inc_return(&priv->record_head) - 1;
+	struct ideapad_wmi_record_slot *slot =
+		&priv->records[pos & (IDEAPAD_WMI_RECORD_RING_SIZE - 1)];
+	struct ideapad_wmi_record *record = &slot->record;
+	size_t kept = min(length, sizeof(record->data));
+
+	WRITE_ONCE(slot->state, 0);
+	smp_wmb();
+
+	record->timestamp_ns = cpu_to_le64(ktime_get_ns());
+	record->seq = cpu_to_le32(pos);
+	record->type = cpu_to_le16(type);
+	record->length = cpu_to_le16(min_t(size_t, length, U16_MAX));
+	memcpy(record->data, data, kept);
+	memset(record->data + kept, 0, sizeof(record->data) - kept);
+
+	smp_store_release(&slot->state, pos + 1);
+}
+
+static void ideapad_wmi_count_event(struct ideapad_wmi_private *priv)
+{
+	this_cpu_inc(priv->stats->events);
+	this_cpu_write(priv->stats->last_event, jiffies);
+}
+
+#ifdef IDEAPAD_WMI_BUFFER_NOTIFY
+/* The WMI core drops events shorter than min_event_size for us */
+static void ideapad_wmi_notify(struct wmi_device *wdev,
+			       const struct wmi_buffer *data)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(&wdev->dev);
+	ktime_t start = ideapad_wmi_latency_start();
+	struct ideapad_wmi_event event = { };
+
+	ideapad_wmi_hot_enter();
+
+	ideapad_wmi_count_event(priv);
+	trace_ideapad_wmi_notify(ACPI_TYPE_BUFFER, data->length);
+
+	if (static_branch_unlikely(&ideapad_wmi_record_enabled))
+		ideapad_wmi_record(priv, ACPI_TYPE_BUFFER, data->data,
+				   data->length);
+
+	ideapad_wmi_decode_buffer(&event, data->data, data->length);
+	ideapad_wmi_handle_event(priv, &event, start);
+
+	ideapad_wmi_hot_exit();
+}
+#else
+static void ideapad_wmi_decode_package(struct ideapad_wmi_event *event,
+				       const union acpi_object *data)
+{
+	const union acpi_object *element;
+	u32 i;
+
+	for (i = 0; i < data->package.count; i++) {
+		element = &data->package.elements[i];
+		if (element->type != ACPI_TYPE_INTEGER) {
+			trace_ideapad_wmi_drop(0, IDEAPAD_WMI_DROP_NOT_INTEGER);
+			event->nr_not_integer++;
+			continue;
+		}
+
+		ideapad_wmi_event_add(event, element->integer.value);
+	}
+}
+
+static void ideapad_wmi_record_object(struct ideapad_wmi_private *priv,
+				      const union acpi_object *data)
+{
+	__le32 words[IDEAPAD_WMI_RECORD_DATA_SIZE / sizeof(u32)];
+	const union acpi_object *element;
+	__le64 value;
+	u32 i;
+
+	switch (data->type) {
+	case ACPI_TYPE_INTEGER:
+		value = cpu_to_le64(data->integer.value);
+		ideapad_wmi_record(priv, data->type, &value, sizeof(value));
+		break;
+	case ACPI_TYPE_PACKAGE:
+		for (i = 0; i < data->package.count && i < ARRAY_SIZE(words); i++) {
+			element = &data->package.elements[i];
+			words[i] = cpu_to_le32(element->type == ACPI_TYPE_INTEGER ?
+					       element->integer.value : 0);
+		}
+		ideapad_wmi_record(priv, data->type, words,
+				   (size_t)data->package.count * sizeof(u32));
+		break;
+	case ACPI_TYPE_BUFFER:
+		ideapad_wmi_record(priv, data->type, data->buffer.pointer,
+				   data->buffer.length);
+		break;
+	default:
+		ideapad_wmi_record(priv, data->type, NULL, 0);
+		break;
+	}
+}
+
+static void ideapad_wmi_notify(struct wmi_device *wdev, union acpi_object *data)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(&wdev->dev);
+	ktime_t start = ideapad_wmi_latency_start();
+	struct ideapad_wmi_event event = { };
+
+	ideapad_wmi_hot_enter();
+
+	ideapad_wmi_count_event(priv);
+	if (static_branch_unlikely(&ideapad_wmi_record_enabled))
+		ideapad_wmi_record_object(priv, data);
+
+	switch (data->type) {
+	case ACPI_TYPE_INTEGER:
+		trace_ideapad_wmi_notify(data->type, data->integer.value);
+		ideapad_wmi_event_add(&event, data->integer.value);
+		break;
+	case ACPI_TYPE_PACKAGE:
+		trace_ideapad_wmi_notify(data->type, data->package.count);
+		ideapad_wmi_decode_package(&event, data);
+		break;
+	case ACPI_TYPE_BUFFER:
+		trace_ideapad_wmi_notify(data->type, data->buffer.length);
+		ideapad_wmi_decode_buffer(&event, data->buffer.pointer,
+					  data->buffer.length);
+		break;
+	default:
+		trace_ideapad_wmi_notify(data->type, 0);
+		trace_ideapad_wmi_drop(0, IDEAPAD_WMI_DROP_NOT_INTEGER);
+		this_cpu_inc(priv->stats->not_integer);
+		WRITE_ONCE(priv->unknown.unsupported_type, data->type);
+		mod_delayed_work(system_wq, &priv->log_work, 0);
+		goto out;
+	}
+
+	if (unlikely(event.nr_not_integer))
+		this_cpu_add(priv->stats->not_integer, event.nr_not_integer);
+
+	ideapad_wmi_handle_event(priv, &event, start);
+out:
+	ideapad_wmi_hot_exit();
+}
+#endif
+
+/* Feeds a synthetic event through the same path as real WMI notifications */
+static void ideapad_wmi_inject_one(struct ideapad_wmi_private *priv,
+				   u32 scancode)
+{
+#ifdef IDEAPAD_WMI_BUFFER_NOTIFY
+	__le32 data = cpu_to_le32(scancode);
+	struct wmi_buffer buffer = {
+		.length = sizeof(data),
+		.data = &data,
+	};
+
+	ideapad_wmi_notify(priv->wmi_device, &buffer);
+#else
+	union acpi_object obj = {
+		.integer = {
+			.type = ACPI_TYPE_INTEGER,
+			.value = scancode,
+		},
+	};
+
+	ideapad_wmi_notify(priv->wmi_device, &obj);
+#endif
+}
+
+/* Events lost by the input path, debounced ones included */
+static u64 ideapad_wmi_inject_dropped(struct ideapad_wmi_private *priv)
+{
+	return ideapad_wmi_stats_read(priv, debounced) +
+	       ideapad_wmi_stats_read(priv, dropped);
+}
+
+static int ideapad_wmi_inject_show(struct seq_file *m, void *unused)
+{
+	struct ideapad_wmi_private *priv = m->private;
+	struct ideapad_wmi_inject_result result;
+
+	mutex_lock(&priv->inject_lock);
+	result = priv->inject;
+	mutex_unlock(&priv->inject_lock);
+
+	seq_printf(m, "events: %llu\n", result.events);
+	seq_printf(m, "dropped: %llu\n", result.dropped);
+	seq_printf(m, "elapsed_ns: %llu\n", result.elapsed_ns);
+	seq_printf(m, "events_per_sec: %llu\n", result.elapsed_ns ?
+		   div64_u64(result.events * NSEC_PER_SEC, result.elapsed_ns) : 0);
+
+	return 0;
+}
+
+static int ideapad_wmi_inject_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ideapad_wmi_inject_show, inode->i_private);
+}
+
+/*
+ * Accepts "<scancode> [count] [interval_us]" and injects count events, one
+ * every interval_us microseconds. Debounced events are reported as dropped,
+ * as is everything counted in ideapad_wmi_stats.dropped: events that did not
+ * fit into the pending queue before the input device was registered or into
+ * the deferred delivery fifo, events arriving after registering the input
+ * device failed or while suspended, and star key presses superseded by a
+ * long-press.
+ */
+static ssize_t ideapad_wmi_inject_write(struct file *file,
+					const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ideapad_wmi_private *priv = m->private;
+	unsigned int nr_events = 1, interval_us = 0;
+	unsigned int i;
+	u64 dropped;
+	s64 start;
+	int scancode;
+	char *cmd;
+	int ret;
+
+	if (count > 64)
+		return -EINVAL;
+
+	cmd = memdup_user_nul(buf, count);
+	if (IS_ERR(cmd))
+		return PTR_ERR(cmd);
+
+	ret = sscanf(cmd, "%i %u %u", &scancode, &nr_events, &interval_us);
+	kfree(cmd);
+	if (ret < 1 || scancode < 0 || !nr_events)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&priv->inject_lock))
+		return -EINTR;
+
+	dropped = ideapad_wmi_inject_dropped(priv);
+	start = ktime_get_ns();
+
+	for (i = 0; i < nr_events && !signal_pending(current); i++) {
+		ideapad_wmi_inject_one(priv, scancode);
+		if (interval_us)
+			fsleep(interval_us);
+		else
+			cond_resched();
+	}
+
+	priv->inject.events = i;
+	priv->inject.elapsed_ns = ktime_get_ns() - start;
+	priv->inject.dropped = ideapad_wmi_inject_dropped(priv) - dropped;
+
+	mutex_unlock(&priv->inject_lock);
+
+	return count;
+}
+
+static const struct file_operations ideapad_wmi_inject_fops = {
+	.owner = THIS_MODULE,
+	.open = ideapad_wmi_inject_open,
+	.read = seq_read,
+	.write = ideapad_wmi_inject_write,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
-static const struct key_entry ideapad_wmi_fn_key_keymap[] = {
-	/* Customizable Lenovo Hotkey (Acts on Windows as macro key) ("star" with 'S' inside) */
-	{ KE_KEY,	0x01, { KEY_PROG1 } },
-	/* Disable FnLock (handled by the firmware) */
-	{ KE_IGNORE,	0x02 },
-	/* Enable FnLock (handled by the firmware) */
-	{ KE_IGNORE,	0x03 },
-	/*
-	 * Snipping (dashed circle with scissors)
-	 *
-	 * Better fit would be KEY_SELECTIVE_SCREENSHOT, but:
-	 * - Not supported by xorg-x11proto:
-	 *   https://github.com/freedesktop/xorg-x11proto/blob/master/XF86keysym.h
-	 * - Not supported by Qt:
-	 *   https://doc.qt.io/qt-6/qt.html#Key-enum
-	 * - Not supported by KDE:
-	 *   https://github.com/KDE/kwindowsystem/blob/9d5cf1a99f71ce2b0efd608c6899171c6ce4e25d/src/platforms/xcb/kkeyserver.cpp
-	 */
-	{ KE_KEY,	0x04, { KEY_F14 } },
-	/* Customizable Lenovo Hotkey ("star" with 'S' inside) (long-press) */
-	{ KE_KEY,	0x08, { KEY_FAVORITES } },
-	/* Sound profile switch */
-	{ KE_KEY,	0x12, { KEY_PROG2 } },
-	/* Dark mode toggle */
-	{ KE_KEY,	0x13, { KEY_PROG3 } },
-	/* Lenovo Support */
-	{ KE_KEY,	0x27, { KEY_HELP } },
-	/* Lenovo Virtual Background application */
-	{ KE_KEY,	0x28, { KEY_PROG4 } },
-	/* Additional keys for Thinkbook 16p2 */
-	{ KE_KEY,       0x0e, { KEY_PICKUP_PHONE } },
-	{ KE_KEY,       0x0f, { KEY_HANGUP_PHONE } },
+/*
+ * The events file is a binary stream of struct ideapad_wmi_record, the file
+ * position selects the first record. Reading starts over at the oldest record
+ * still in the ring if the requested ones were overwritten.
+ */
+static ssize_t ideapad_wmi_events_read(struct file *file, char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	struct ideapad_wmi_private *priv = file->private_data;
+	struct ideapad_wmi_record_slot *slot;
+	struct ideapad_wmi_record record;
+	u64 head = atomic64_read(&priv->record_head);
+	u64 pos = *ppos / sizeof(record);
+	size_t copied = 0;
+	u64 state;
 
-	{ KE_END },
+	if (head > IDEAPAD_WMI_RECORD_RING_SIZE)
+		pos = max(pos, head - IDEAPAD_WMI_RECORD_RING_SIZE);
+
+	for (; pos < head && count - copied >= sizeof(record); pos++) {
+		slot = &priv->records[pos & (IDEAPAD_WMI_RECORD_RING_SIZE - 1)];
+
+		/* Stop at records still being written, skip overwritten ones */
+		state = smp_load_acquire(&slot->state);
+		if (state < pos + 1)
+			break;
+		if (state > pos + 1)
+			continue;
+
+		memcpy(&record, &slot->record, sizeof(record));
+		smp_rmb();
+		if (READ_ONCE(slot->state) != state)
+			continue;
+
+		if (copy_to_user(buf + copied, &record, sizeof(record))) {
+			if (!copied)
+				return -EFAULT;
+			break;
+		}
+		copied += sizeof(record);
+	}
+
+	*ppos = pos * sizeof(record);
+	return copied;
+}
+
+static const struct file_operations ideapad_wmi_events_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = ideapad_wmi_events_read,
+	.llseek = default_llseek,
 };
 
-static int ideapad_wmi_input_init(struct ideapad_wmi_private *priv)
+/* Rebuilds the recorded event and feeds it through the notify path */
+static void ideapad_wmi_replay_one(struct ideapad_wmi_private *priv,
+				   struct ideapad_wmi_record *record)
 {
-	struct input_dev *input_dev;
-	int err;
+	size_t length = min_t(size_t, le16_to_cpu(record->length),
+			      sizeof(record->data));
+#ifdef IDEAPAD_WMI_BUFFER_NOTIFY
+	struct wmi_buffer buffer = {
+		.length = length,
+		.data = record->data,
+	};
 
-	input_dev = input_allocate_device();
-	if (!input_dev) {
-		return -ENOMEM;
+	/* Integers recorded on older kernels carry the scancode first */
+	if (le16_to_cpu(record->type) == ACPI_TYPE_INTEGER)
+		buffer.length = sizeof(u32);
+
+	/* Mimic min_event_size, the WMI core would drop these */
+	if (buffer.length < sizeof(u32))
+		return;
+
+	ideapad_wmi_notify(priv->wmi_device, &buffer);
+#else
+	union acpi_object elements[IDEAPAD_WMI_RECORD_DATA_SIZE / sizeof(u32)];
+	union acpi_object obj = { .type = le16_to_cpu(record->type) };
+	u32 i;
+
+	switch (obj.type) {
+	case ACPI_TYPE_INTEGER:
+		obj.integer.value = get_unaligned_le64(record->data);
+		break;
+	case ACPI_TYPE_PACKAGE:
+		for (i = 0; i < length / sizeof(u32); i++) {
+			elements[i].integer.type = ACPI_TYPE_INTEGER;
+			elements[i].integer.value =
+				get_unaligned_le32(record->data + i * sizeof(u32));
+		}
+		obj.package.count = i;
+		obj.package.elements = elements;
+		break;
+	case ACPI_TYPE_BUFFER:
+		obj.buffer.length = length;
+		obj.buffer.pointer = record->data;
+		break;
 	}
 
-	input_dev->name = "Ideapad WMI Fn Keys";
-	input_dev->phys = IDEAPAD_FN_KEY_EVENT_GUID "/input0";
-	input_dev->id.bustype = BUS_HOST;
-	input_dev->dev.parent = &priv->wmi_device->dev;
+	ideapad_wmi_notify(priv->wmi_device, &obj);
+#endif
+}
 
-	err = sparse_keymap_setup(input_dev, ideapad_wmi_fn_key_keymap, NULL);
-	if (err) {
-		dev_err(&priv->wmi_device->dev,
-			"Could not set up input device keymap: %d\n", err);
-		goto err_free_dev;
+/*
+ * Accepts a stream of records as read from the events file and replays them
+ * with their original spacing, capped at IDEAPAD_WMI_REPLAY_MAX_GAP_NS. The
+ * outcome is reported by the inject file.
+ */
+static ssize_t ideapad_wmi_replay_write(struct file *file,
+					const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	struct ideapad_wmi_private *priv = file->private_data;
+	struct ideapad_wmi_record record;
+	u64 prev_ns = 0, ns, dropped;
+	size_t offset;
+	s64 start;
+	int err = 0;
+
+	if (!count || count % sizeof(record))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&priv->inject_lock))
+		return -EINTR;
+
+	dropped = ideapad_wmi_inject_dropped(priv);
+	start = ktime_get_ns();
+
+	for (offset = 0; offset < count && !signal_pending(current);
+	     offset += sizeof(record)) {
+		if (copy_from_user(&record, buf + offset, sizeof(record))) {
+			err = -EFAULT;
+			break;
+		}
+
+		ns = le64_to_cpu(record.timestamp_ns);
+		if (offset && ns > prev_ns)
+			fsleep(div_u64(min_t(u64, ns - prev_ns,
+					     IDEAPAD_WMI_REPLAY_MAX_GAP_NS),
+				       NSEC_PER_USEC));
+		else
+			cond_resched();
+		prev_ns = ns;
+
+		ideapad_wmi_replay_one(priv, &record);
 	}
 
-	err = input_register_device(input_dev);
-	if (err) {
-		dev_err(&priv->wmi_device->dev,
-			"Could not register input device: %d\n", err);
-		goto err_free_dev;
+	priv->inject.events = offset / sizeof(record);
+	priv->inject.elapsed_ns = ktime_get_ns() - start;
+	priv->inject.dropped = ideapad_wmi_inject_dropped(priv) - dropped;
+
+	mutex_unlock(&priv->inject_lock);
+
+	if (offset)
+		return offset;
+	return err ?: -EINTR;
+}
+
+static const struct file_operations ideapad_wmi_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = ideapad_wmi_replay_write,
+	.llseek = default_llseek,
+};
+
+static int ideapad_wmi_unknown_scancodes_show(struct seq_file *m, void *unused)
+{
+	struct ideapad_wmi_private *priv = m->private;
+	struct ideapad_wmi_unknown_stats *unknown = &priv->unknown;
+	unsigned int scancode;
+	int count;
+
+	for (scancode = 0; scancode < IDEAPAD_WMI_UNKNOWN_HIST_SIZE; scancode++) {
+		count = atomic_read(&unknown->hist[scancode]);
+		if (count)
+			seq_printf(m, "%#04x %d\n", scancode, count);
 	}
 
-	priv->input_dev = input_dev;
+	seq_printf(m, "other %d\n", atomic_read(&unknown->overflow));
 	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ideapad_wmi_unknown_scancodes);
 
-err_free_dev:
-	input_free_device(input_dev);
-	return err;
+static void ideapad_wmi_debugfs_init(struct ideapad_wmi_private *priv)
+{
+	priv->debugfs_dir = debugfs_create_dir(dev_name(&priv->wmi_device->dev),
+					       ideapad_wmi_debugfs_root);
+
+	debugfs_create_file("unknown_scancodes", 0444, priv->debugfs_dir, priv,
+			    &ideapad_wmi_unknown_scancodes_fops);
+	debugfs_create_file("latency", 0644, priv->debugfs_dir, priv,
+			    &ideapad_wmi_latency_fops);
+	debugfs_create_file("inject", 0600, priv->debugfs_dir, priv,
+			    &ideapad_wmi_inject_fops);
+	debugfs_create_file("events", 0400, priv->debugfs_dir, priv,
+			    &ideapad_wmi_events_fops);
+	debugfs_create_file("replay", 0200, priv->debugfs_dir, priv,
+			    &ideapad_wmi_replay_fops);
 }
 
-static void ideapad_wmi_input_exit(struct ideapad_wmi_private *priv)
+static void ideapad_wmi_debugfs_exit(struct ideapad_wmi_private *priv)
 {
-	input_unregister_device(priv->input_dev);
-	priv->input_dev = NULL;
+	debugfs_remove_recursive(priv->debugfs_dir);
+	priv->debugfs_dir = NULL;
 }
 
-static void ideapad_wmi_input_report(struct ideapad_wmi_private *priv,
-				     unsigned int scancode)
+/* Reports the events queued before the input device was registered */
+static void ideapad_wmi_flush_pending(struct ideapad_wmi_private *priv)
 {
-    if (!sparse_keymap_report_event(priv->input_dev, scancode, 1, true))
-		pr_info("ideapad-wmi-fn-keys: Unknown scancode %x\n", scancode);
+	struct ideapad_wmi_frame frame = { .input_dev = priv->input_dev };
+	unsigned long flags;
+	u32 scancode;
+
+	spin_lock_irqsave(&priv->pending_lock, flags);
+
+	rcu_read_lock();
+	/* Preceded everything still queued, and already waited for */
+	if (priv->star_key_pending) {
+		priv->star_key_pending = false;
+		ideapad_wmi_input_report_filtered(priv, &frame,
+						  IDEAPAD_WMI_STAR_KEY);
+	}
+	while (kfifo_get(&priv->pending, &scancode))
+		ideapad_wmi_input_report(priv, &frame, scancode);
+	ideapad_wmi_frame_flush(&frame);
+	rcu_read_unlock();
+
+	if (priv->ring)
+		ideapad_wmi_ring_wake(priv->ring);
+
+	rcu_assign_pointer(priv->event_dev, priv->input_dev);
+
+	spin_unlock_irqrestore(&priv->pending_lock, flags);
 }
 
-static int ideapad_wmi_probe(struct wmi_device *wdev, const void *ctx)
+/* Drops the events queued so far and every later one */
+static void ideapad_wmi_input_failed(struct ideapad_wmi_private *priv, int err)
+{
+	unsigned long flags;
+	u32 scancode;
+
+	spin_lock_irqsave(&priv->pending_lock, flags);
+
+	priv->input_err = err;
+	if (priv->star_key_pending) {
+		priv->star_key_pending = false;
+		trace_ideapad_wmi_drop(IDEAPAD_WMI_STAR_KEY,
+				       IDEAPAD_WMI_DROP_NOT_READY);
+		this_cpu_inc(priv->stats->dropped);
+	}
+	while (kfifo_get(&priv->pending, &scancode)) {
+		trace_ideapad_wmi_drop(scancode, IDEAPAD_WMI_DROP_NOT_READY);
+		this_cpu_inc(priv->stats->dropped);
+	}
+
+	spin_unlock_irqrestore(&priv->pending_lock, flags);
+}
+
+static void ideapad_wmi_input_work(struct work_struct *work)
+{
+	struct ideapad_wmi_private *priv =
+		container_of(work, struct ideapad_wmi_private, input_work);
+	int err;
+
+	err = ideapad_wmi_input_init(priv);
+	if (err) {
+		ideapad_wmi_input_failed(priv, err);
+		return;
+	}
+
+	ideapad_wmi_flush_pending(priv);
+
+	dev_dbg(&priv->wmi_device->dev,
+		"Input device registered %lld us after probe\n",
+		ktime_us_delta(ktime_get(), priv->probe_start));
+}
+
+static void ideapad_wmi_shared_free(struct ideapad_wmi_private *priv)
+{
+	free_percpu(priv->latency);
+	free_percpu(priv->stats);
+	kfree(priv->arena);
+	kfree(priv);
+}
+
+/*
+ * Sets up the state shared by all instances, owned by the first one bound.
+ * Nothing in it is device managed, it may outlive that instance.
+ */
+static struct ideapad_wmi_private *
+ideapad_wmi_shared_create(struct wmi_device *wdev)
 {
 	struct ideapad_wmi_private *priv;
 	int err;
 
-	priv = devm_kzalloc(&wdev->dev, sizeof(*priv), GFP_KERNEL);
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
 	if (!priv)
+		return ERR_PTR(-ENOMEM);
+
+	priv->wmi_device = wdev;
+	priv->probe_start = ktime_get();
+	INIT_LIST_HEAD(&priv->instances);
+	mutex_init(&priv->instances_lock);
+	spin_lock_init(&priv->keymap_lock);
+	spin_lock_init(&priv->pending_lock);
+	mutex_init(&priv->inject_lock);
+	mutex_init(&priv->macro_lock);
+	INIT_KFIFO(priv->pending);
+	spin_lock_init(&priv->delivery_lock);
+	INIT_KFIFO(priv->delivery);
+	INIT_WORK(&priv->delivery_work, ideapad_wmi_delivery_work);
+	INIT_WORK(&priv->input_work, ideapad_wmi_input_work);
+	INIT_WORK(&priv->fn_lock_work, ideapad_wmi_fn_lock_work);
+	INIT_DELAYED_WORK(&priv->log_work, ideapad_wmi_log_work);
+	hrtimer_setup(&priv->long_press_timer, ideapad_wmi_long_press_expired,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+
+	err = -ENOMEM;
+	priv->stats = alloc_percpu(struct ideapad_wmi_stats);
+	if (!priv->stats)
+		goto err_free;
+
+	priv->latency = alloc_percpu(struct ideapad_wmi_latency_stats);
+	if (!priv->latency)
+		goto err_free;
+
+	priv->arena = kzalloc(sizeof(*priv->arena), GFP_KERNEL);
+	if (!priv->arena)
+		goto err_free;
+
+	priv->records = priv->arena->records;
+	priv->macro_arena = priv->arena->macros;
+
+	ratelimit_state_init(&priv->unknown.summary_rs,
+			     IDEAPAD_WMI_UNKNOWN_SUMMARY_INTERVAL, 1);
+	ratelimit_set_flags(&priv->unknown.summary_rs, RATELIMIT_MSG_ON_RELEASE);
+
+	err = ideapad_wmi_keymap_init(priv);
+	if (err)
+		goto err_free;
+
+	err = ideapad_wmi_ring_init(priv);
+	if (err)
+		goto err_keymap;
+
+	/* Per-CPU rather than unbound, so that delivery_cpu is honoured */
+	if (deferred_delivery) {
+		priv->delivery_wq = alloc_workqueue("%s-%s", WQ_HIGHPRI, 0,
+						    KBUILD_MODNAME,
+						    dev_name(&wdev->dev));
+		if (!priv->delivery_wq) {
+			err = -ENOMEM;
+			goto err_ring;
+		}
+	}
+
+	ideapad_wmi_debugfs_init(priv);
+
+	/*
+	 * Registering the input device serializes with udev and the input
+	 * core, do it asynchronously and queue the events arriving meanwhile.
+	 */
+	if (input_device)
+		queue_work(system_unbound_wq, &priv->input_work);
+
+	return priv;
+
+err_ring:
+	ideapad_wmi_ring_exit(priv);
+err_keymap:
+	ideapad_wmi_keymap_exit(priv);
+err_free:
+	ideapad_wmi_shared_free(priv);
+	return ERR_PTR(err);
+}
+
+static void ideapad_wmi_shared_destroy(struct ideapad_wmi_private *priv)
+{
+	cancel_work_sync(&priv->input_work);
+	if (priv->input_dev)
+		ideapad_wmi_input_exit(priv);
+	else
+		synchronize_rcu();	/* Let events still publishing keys finish */
+	/*
+	 * Only now, the injector stays live across the unpublish above so
+	 * that stress-bind-unbind.sh can race it.
+	 */
+	ideapad_wmi_debugfs_exit(priv);
+	/* Flushes the worker, which may still arm the long-press timer */
+	if (priv->delivery_wq)
+		destroy_workqueue(priv->delivery_wq);
+	hrtimer_cancel(&priv->long_press_timer);
+	cancel_work_sync(&priv->fn_lock_work);
+	cancel_delayed_work_sync(&priv->log_work);
+	ideapad_wmi_ring_exit(priv);
+	ideapad_wmi_keymap_exit(priv);
+	ideapad_wmi_shared_free(priv);
+}
+
+/*
+ * Hands the input and misc devices over to another instance when their
+ * parent goes away first, and waits for everything that may still use the
+ * old wmi_device.
+ */
+static void ideapad_wmi_shared_move(struct ideapad_wmi_private *priv,
+				    struct wmi_device *wdev)
+{
+	struct device *parent = &wdev->dev;
+	int err = 0;
+
+	flush_work(&priv->input_work);
+
+	mutex_lock(&priv->inject_lock);
+	WRITE_ONCE(priv->wmi_device, wdev);
+	mutex_unlock(&priv->inject_lock);
+
+	synchronize_rcu();
+	flush_delayed_work(&priv->log_work);
+
+	if (priv->input_dev)
+		err = device_move(&priv->input_dev->dev, parent,
+				  DPM_ORDER_PARENT_BEFORE_DEV);
+	if (!err && priv->ring)
+		err = device_move(priv->ring->misc.this_device, parent,
+				  DPM_ORDER_PARENT_BEFORE_DEV);
+	if (err)
+		dev_warn(parent, "Failed to take over shared devices: %d\n",
+			 err);
+}
+
+static int ideapad_wmi_probe(struct wmi_device *wdev, const void *ctx)
+{
+	struct ideapad_wmi_instance *instance;
+	struct ideapad_wmi_private *priv;
+	ktime_t start = ktime_get();
+
+	instance = devm_kzalloc(&wdev->dev, sizeof(*instance), GFP_KERNEL);
+	if (!instance)
 		return -ENOMEM;
 
+	instance->wdev = wdev;
+
+	mutex_lock(&ideapad_wmi_shared_lock);
+
+	priv = ideapad_wmi_shared;
+	if (!priv) {
+		priv = ideapad_wmi_shared_create(wdev);
+		if (IS_ERR(priv)) {
+			mutex_unlock(&ideapad_wmi_shared_lock);
+			return PTR_ERR(priv);
+		}
+		ideapad_wmi_shared = priv;
+	}
+
+	mutex_lock(&priv->instances_lock);
+	list_add_tail(&instance->node, &priv->instances);
+	mutex_unlock(&priv->instances_lock);
+
 	dev_set_drvdata(&wdev->dev, priv);
 
-	priv->wmi_device = wdev;
+	mutex_unlock(&ideapad_wmi_shared_lock);
 
-	err = ideapad_wmi_input_init(priv);
-	if (err)
-		return err;
+	/* Only keys with the wakeup option report wakeup events */
+	device_init_wakeup(&wdev->dev, true);
+
+	dev_dbg(&wdev->dev, "Probed in %lld us\n",
+		ktime_us_delta(ktime_get(), start));
 
 	return 0;
 }
@@ -137,23 +3504,64 @@ static int ideapad_wmi_probe(struct wmi_device *wdev, const void *ctx)
 static void ideapad_wmi_remove(struct wmi_device *wdev)
 {
 	struct ideapad_wmi_private *priv = dev_get_drvdata(&wdev->dev);
+	struct ideapad_wmi_instance *instance, *next;
+
+	device_init_wakeup(&wdev->dev, false);
+
+	mutex_lock(&ideapad_wmi_shared_lock);
+
+	mutex_lock(&priv->instances_lock);
+	list_for_each_entry(instance, &priv->instances, node) {
+		if (instance->wdev == wdev) {
+			list_del(&instance->node);
+			break;
+		}
+	}
+	next = list_first_entry_or_null(&priv->instances,
+					struct ideapad_wmi_instance, node);
+	mutex_unlock(&priv->instances_lock);
+
+	if (!next) {
+		ideapad_wmi_shared = NULL;
+		ideapad_wmi_shared_destroy(priv);
+	} else if (priv->wmi_device == wdev) {
+		ideapad_wmi_shared_move(priv, next->wdev);
+	}
 
-	ideapad_wmi_input_exit(priv);
+	mutex_unlock(&ideapad_wmi_shared_lock);
 }
 
-static void ideapad_wmi_notify(struct wmi_device *wdev, union acpi_object *data)
+/*
+ * The input device and keymap stay registered across suspend, only the event
+ * path is quiesced.
+ */
+static int ideapad_wmi_suspend(struct device *dev)
 {
-	struct ideapad_wmi_private *priv = dev_get_drvdata(&wdev->dev);
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
 
-	if(data->type != ACPI_TYPE_INTEGER) {
-		dev_warn(&priv->wmi_device->dev,
-			"WMI event data is not an integer\n");
-		return;
-	}
+	clear_bit(0, &priv->wakeup_pending);
+	WRITE_ONCE(priv->suspended, true);
+	hrtimer_cancel(&priv->long_press_timer);
+
+	return 0;
+}
+
+static int ideapad_wmi_resume(struct device *dev)
+{
+	struct ideapad_wmi_private *priv = dev_get_drvdata(dev);
 
-	ideapad_wmi_input_report(priv, data->integer.value);
+	WRITE_ONCE(priv->suspended, false);
+
+	return 0;
 }
 
+static DEFINE_SIMPLE_DEV_PM_OPS(ideapad_wmi_pm_ops, ideapad_wmi_suspend,
+				ideapad_wmi_resume);
+
+/*
+ * Every bound instance feeds the one input device and keymap, further event
+ * GUIDs only need an entry here.
+ */
 static const struct wmi_device_id ideapad_wmi_id_table[] = {
 	{	/* Special Keys on the Yoga 9 14IAP7 */
 		.guid_string = IDEAPAD_FN_KEY_EVENT_GUID
@@ -164,16 +3572,55 @@ static const struct wmi_device_id ideapad_wmi_id_table[] = {
 static struct wmi_driver ideapad_wmi_driver = {
 	.driver = {
 		.name = "ideapad-wmi-fn-keys",
+		.dev_groups = ideapad_wmi_groups,
+		.pm = pm_sleep_ptr(&ideapad_wmi_pm_ops),
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 	.id_table = ideapad_wmi_id_table,
 	.probe = ideapad_wmi_probe,
 	.remove = ideapad_wmi_remove,
+#ifdef IDEAPAD_WMI_BUFFER_NOTIFY
+	.min_event_size = sizeof(u32),
+	.notify_new = ideapad_wmi_notify,
+#else
 	.notify = ideapad_wmi_notify,
+#endif
 };
 
-module_wmi_driver(ideapad_wmi_driver);
+/* The KUnit module includes this file and must not register the driver */
+#ifndef IDEAPAD_WMI_KUNIT
+static int __init ideapad_wmi_init(void)
+{
+	const struct dmi_system_id *dmi_id;
+	int err;
+
+	dmi_id = dmi_first_match(ideapad_wmi_dmi_table);
+	if (dmi_id)
+		ideapad_wmi_model_keymaps = dmi_id->driver_data;
+
+	err = ideapad_wmi_bpf_init();
+	if (err)
+		return err;
+
+	ideapad_wmi_debugfs_root = debugfs_create_dir(KBUILD_MODNAME, NULL);
+
+	err = wmi_driver_register(&ideapad_wmi_driver);
+	if (err)
+		debugfs_remove_recursive(ideapad_wmi_debugfs_root);
+
+	return err;
+}
+module_init(ideapad_wmi_init);
+
+static void __exit ideapad_wmi_exit(void)
+{
+	wmi_driver_unregister(&ideapad_wmi_driver);
+	debugfs_remove_recursive(ideapad_wmi_debugfs_root);
+}
+module_exit(ideapad_wmi_exit);
 
 MODULE_DEVICE_TABLE(wmi, ideapad_wmi_id_table);
+#endif
 MODULE_AUTHOR("Ulrich Huber <ulrich@huberulrich.de>");
 MODULE_DESCRIPTION("Ideapad WMI fn keys driver");
 MODULE_LICENSE("GPL");
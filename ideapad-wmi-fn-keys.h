@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ * ideapad-wmi-fn-keys.h - Userspace interface of the Ideapad WMI fn keys
+ * event ring
+ *
+ * With the event_ring module parameter set, /dev/ideapad-wmi-fn-keys can be
+ * mapped read-only. The first page holds struct ideapad_wmi_ring_header, the
+ * records start at data_offset. Record n lives at index n % nr_records and is
+ * complete once head is greater than n. The writer starts overwriting it as
+ * soon as head reaches n + nr_records, so record n is invalid once
+ * head - n >= nr_records. Readers must copy the record, issue a read barrier
+ * (smp_rmb(), or atomic_thread_fence(memory_order_acquire) in C11) to order
+ * the copy before it, then re-read head and discard the copy if the
+ * condition holds. An acquire load of head alone does not order the copy
+ * made before it.
+ *
+ * read() blocks until head moved since the last read() on the same file and
+ * returns the new head as a __u64. poll() reports EPOLLIN under the same
+ * condition and EPOLLHUP once the device is gone.
+ */
+
+#ifndef _UAPI_IDEAPAD_WMI_FN_KEYS_H
+#define _UAPI_IDEAPAD_WMI_FN_KEYS_H
+
+#include <linux/types.h>
+
+#define IDEAPAD_WMI_RING_VERSION	1
+
+struct ideapad_wmi_ring_header {
+	__u32 version;
+	__u32 record_size;
+	__u32 nr_records;
+	__u32 data_offset;
+	/* Number of records ever written, updated with release semantics */
+	__u64 head;
+};
+
+/* One record per key press, keycode is KEY_UNKNOWN for unmapped scancodes */
+struct ideapad_wmi_ring_record {
+	__u64 timestamp_ns;	/* CLOCK_MONOTONIC */
+	__u32 scancode;
+	__u16 keycode;
+	__u16 reserved;
+};
+
+#endif /* _UAPI_IDEAPAD_WMI_FN_KEYS_H */
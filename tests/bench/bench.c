@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * bench.c - Userspace throughput benchmarks for the Ideapad WMI fn keys
+ * event path
+ *
+ * Built and run by "make bench" against the mocks in kernel.h. Pass the number
+ * of events per benchmark as the first argument, BENCH_CFLAGS selects
+ * optimization and sanitizers.
+ */
+
+#include "../../ideapad-wmi-fn-keys.c"
+
+#define BENCH_DEFAULT_EVENTS	10000000UL
+
+struct bench {
+	const char *name;
+	void (*run)(struct ideapad_wmi_private *priv, unsigned long nr_events);
+};
+
+/* Keeps lookups from being optimized out */
+static const void *volatile bench_sink;
+
+static void bench_notify_words(struct ideapad_wmi_private *priv,
+			       __le32 *words, size_t nr_words)
+{
+#ifdef IDEAPAD_WMI_BUFFER_NOTIFY
+	struct wmi_buffer buffer = {
+		.length = nr_words * sizeof(*words),
+		.data = words,
+	};
+
+	ideapad_wmi_notify(priv->wmi_device, &buffer);
+#else
+	union acpi_object obj = {
+		.buffer = {
+			.type = ACPI_TYPE_BUFFER,
+			.length = nr_words * sizeof(*words),
+			.pointer = (u8 *)words,
+		},
+	};
+
+	ideapad_wmi_notify(priv->wmi_device, &obj);
+#endif
+}
+
+static void bench_lookup(struct ideapad_wmi_private *priv,
+			 unsigned long nr_events, u32 scancode)
+{
+	struct ideapad_wmi_keymap *keymap = rcu_dereference(priv->keymap);
+	unsigned long i;
+
+	for (i = 0; i < nr_events; i++)
+		bench_sink = ideapad_wmi_keymap_lookup(keymap, scancode);
+}
+
+static void bench_lookup_indexed(struct ideapad_wmi_private *priv,
+				 unsigned long nr_events)
+{
+	bench_lookup(priv, nr_events, 0x01);
+}
+
+/* Misses the index and probes the hash table */
+static void bench_lookup_miss(struct ideapad_wmi_private *priv,
+			      unsigned long nr_events)
+{
+	bench_lookup(priv, nr_events, 0x40);
+}
+
+static void bench_report(struct ideapad_wmi_private *priv,
+			 unsigned long nr_events, u32 scancode)
+{
+	struct ideapad_wmi_frame frame = { .input_dev = priv->input_dev };
+	unsigned long i;
+
+	rcu_read_lock();
+	for (i = 0; i < nr_events; i++) {
+		ideapad_wmi_input_report(priv, &frame, scancode);
+		ideapad_wmi_frame_flush(&frame);
+	}
+	rcu_read_unlock();
+}
+
+static void bench_report_known(struct ideapad_wmi_private *priv,
+			       unsigned long nr_events)
+{
+	bench_report(priv, nr_events, 0x01);
+}
+
+static void bench_report_ignored(struct ideapad_wmi_private *priv,
+				 unsigned long nr_events)
+{
+	bench_report(priv, nr_events, 0x02);
+}
+
+static void bench_report_unknown(struct ideapad_wmi_private *priv,
+				 unsigned long nr_events)
+{
+	bench_report(priv, nr_events, 0x40);
+}
+
+/* Ctrl+C then Ctrl+V, four frames per event */
+static void bench_report_macro(struct ideapad_wmi_private *priv,
+			       unsigned long nr_events)
+{
+	static const char macro[] = "0x40 29+46 29+47";
+	struct device *dev = &priv->wmi_device->dev;
+
+	macros_store(dev, NULL, macro, strlen(macro));
+	bench_report(priv, nr_events, 0x40);
+	macros_store(dev, NULL, "", 0);
+}
+
+static void bench_notify_single(struct ideapad_wmi_private *priv,
+				unsigned long nr_events)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr_events; i++)
+		ideapad_wmi_inject_one(priv, 0x01);
+}
+
+/* One event per scancode, delivered IDEAPAD_WMI_MAX_EVENT_SCANCODES at a time */
+static void bench_notify_batch(struct ideapad_wmi_private *priv,
+			       unsigned long nr_events)
+{
+	static const u32 scancodes[] = { 0x01, 0x04, 0x12, 0x13, 0x27, 0x28 };
+	__le32 words[IDEAPAD_WMI_MAX_EVENT_SCANCODES];
+	unsigned long i;
+
+	for (i = 0; i < ARRAY_SIZE(words); i++)
+		words[i] = cpu_to_le32(scancodes[i % ARRAY_SIZE(scancodes)]);
+
+	for (i = 0; i < nr_events; i += ARRAY_SIZE(words))
+		bench_notify_words(priv, words, ARRAY_SIZE(words));
+}
+
+static void bench_notify_debounced(struct ideapad_wmi_private *priv,
+				   unsigned long nr_events)
+{
+	unsigned int saved = debounce_ms;
+	unsigned long i;
+
+	debounce_ms = 1000;
+	for (i = 0; i < nr_events; i++)
+		ideapad_wmi_inject_one(priv, 0x12);
+	debounce_ms = saved;
+}
+
+static const struct bench benches[] = {
+	{ "lookup_indexed",	bench_lookup_indexed },
+	{ "lookup_miss",	bench_lookup_miss },
+	{ "report_known",	bench_report_known },
+	{ "report_ignored",	bench_report_ignored },
+	{ "report_unknown",	bench_report_unknown },
+	{ "report_macro",	bench_report_macro },
+	{ "notify_single",	bench_notify_single },
+	{ "notify_batch",	bench_notify_batch },
+	{ "notify_debounced",	bench_notify_debounced },
+};
+
+int main(int argc, char **argv)
+{
+	unsigned long nr_events = BENCH_DEFAULT_EVENTS;
+	struct ideapad_wmi_private *priv;
+	struct wmi_device wdev = {
+		.dev = { .name = "bench" },
+	};
+	struct wmi_device wdev2 = {
+		.dev = { .name = "bench.1" },
+	};
+	u64 start, ns, events, syncs;
+	unsigned int i;
+	int err;
+
+	if (argc > 1)
+		nr_events = strtoul(argv[1], NULL, 0);
+	if (!nr_events) {
+		fprintf(stderr, "usage: %s [events]\n", argv[0]);
+		return 1;
+	}
+
+	keymap_firmware = "";
+	err = ideapad_wmi_probe(&wdev, NULL);
+	if (err) {
+		fprintf(stderr, "probe failed: %d\n", err);
+		return 1;
+	}
+	priv = dev_get_drvdata(&wdev.dev);
+
+	/* A second instance shares the state, removing the first hands over */
+	err = ideapad_wmi_probe(&wdev2, NULL);
+	if (err || dev_get_drvdata(&wdev2.dev) != priv) {
+		fprintf(stderr, "second probe failed: %d\n", err);
+		return 1;
+	}
+
+	printf("%-18s %10s %12s %10s %10s\n", "benchmark", "ns/event",
+	       "events/s", "input", "syncs");
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		events = bench_input_events;
+		syncs = bench_input_syncs;
+
+		start = ktime_get_ns();
+		benches[i].run(priv, nr_events);
+		ns = ktime_get_ns() - start;
+
+		printf("%-18s %10.2f %12.0f %10llu %10llu\n", benches[i].name,
+		       (double)ns / nr_events, nr_events * 1e9 / (ns ?: 1),
+		       bench_input_events - events, bench_input_syncs - syncs);
+	}
+
+	printf("dropped: %llu\n", ideapad_wmi_inject_dropped(priv));
+
+	ideapad_wmi_remove(&wdev);
+	if (priv->wmi_device != &wdev2 ||
+	    (priv->input_dev && priv->input_dev->dev.parent != &wdev2.dev)) {
+		fprintf(stderr, "shared devices not handed over\n");
+		return 1;
+	}
+	ideapad_wmi_remove(&wdev2);
+	bench_devres_release();
+
+	return 0;
+}
@@ -0,0 +1,1145 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Userspace stand-ins for the kernel APIs used by ideapad-wmi-fn-keys.c
+ *
+ * Every <linux/...> header the driver includes resolves to a generated stub
+ * that includes this file. Only the event path is modelled faithfully, the
+ * rest is just enough to compile and run probe/remove. Single CPU, single
+ * thread.
+ */
+
+#ifndef _IDEAPAD_WMI_BENCH_KERNEL_H
+#define _IDEAPAD_WMI_BENCH_KERNEL_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/input-event-codes.h>
+
+/* Compiler and types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int32_t s32;
+typedef long long s64;
+typedef u16 __le16;
+typedef u32 __le32;
+typedef u64 __le64;
+typedef unsigned short umode_t;
+typedef int gfp_t;
+
+#define __packed		__attribute__((packed))
+#define __user
+#define __rcu
+#define __percpu
+#define __init
+#define __exit
+#define __ro_after_init
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define BIT(n)			(1UL << (n))
+#define BIT_ULL(n)		(1ULL << (n))
+#define BITS_PER_LONG		(8 * sizeof(long))
+#define BITS_TO_LONGS(n)	(((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define U16_MAX			UINT16_MAX
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define clamp(v, lo, hi)	min(max(v, lo), hi)
+/* No Kconfig, every option is off */
+#define IS_ENABLED(option)	0
+#define min_t(t, a, b)		min((t)(a), (t)(b))
+#define max_t(t, a, b)		max((t)(a), (t)(b))
+#define ilog2(n)		(63 - __builtin_clzll(n))
+#define order_base_2(n)		((n) > 1 ? ilog2((n) - 1) + 1 : 0)
+#define container_of(p, t, m)	((t *)((char *)(p) - offsetof(t, m)))
+#define BUILD_BUG_ON_ZERO(e)	((int)(sizeof(struct { int:(-!!(e)); })))
+#define __maybe_unused		__attribute__((unused))
+#define struct_size(p, m, n)	(sizeof(*(p)) + sizeof((p)->m[0]) * (n))
+
+#define KBUILD_MODNAME		"ideapad_wmi_fn_keys"
+
+#define KERNEL_VERSION(a, b, c)	(((a) << 16) + ((b) << 8) + (c))
+#ifndef LINUX_VERSION_CODE
+#define LINUX_VERSION_CODE	KERNEL_VERSION(6, 19, 0)
+#endif
+
+#define le16_to_cpu(x)		((u16)(x))
+#define le32_to_cpu(x)		((u32)(x))
+#define le64_to_cpu(x)		((u64)(x))
+#define cpu_to_le16(x)		((__le16)(x))
+#define cpu_to_le32(x)		((__le32)(x))
+#define cpu_to_le64(x)		((__le64)(x))
+
+static inline u32 get_unaligned_le32(const void *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u64 get_unaligned_le64(const void *p)
+{
+	u64 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+	return (val * 0x61C88647U) >> (32 - bits);
+}
+
+static inline u64 div_u64(u64 a, u32 b) { return a / b; }
+static inline u64 div64_u64(u64 a, u64 b) { return a / b; }
+
+/* Errors and memory */
+
+#define MAX_ERRNO		4095
+#define ERR_PTR(e)		((void *)(long)(e))
+#define PTR_ERR(p)		((long)(p))
+#define IS_ERR(p)		((unsigned long)(p) >= (unsigned long)-MAX_ERRNO)
+
+#define GFP_KERNEL		0
+
+static inline void *kzalloc(size_t size, gfp_t gfp) { return calloc(1, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp) { return calloc(n, size); }
+static inline void kfree(const void *p) { free((void *)p); }
+#define kfree_rcu(p, f)		kfree(p)
+#define kvzalloc(size, gfp)	kzalloc(size, gfp)
+#define kvfree(p)		kfree(p)
+#define kvfree_rcu(p, f)	kfree(p)
+
+static inline char *kstrndup(const char *s, size_t n, gfp_t gfp)
+{
+	return strndup(s, n);
+}
+
+static inline void *memdup_user_nul(const void *src, size_t n)
+{
+	char *p = malloc(n + 1);
+
+	if (!p)
+		return ERR_PTR(-ENOMEM);
+	memcpy(p, src, n);
+	p[n] = 0;
+	return p;
+}
+
+static inline unsigned long copy_to_user(void *to, const void *from,
+					 unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from,
+					   unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline bool str_has_prefix(const char *s, const char *prefix)
+{
+	return !strncmp(s, prefix, strlen(prefix));
+}
+
+static inline int kstrtoull_base(const char *s, unsigned int base, u64 *res,
+				 u64 limit)
+{
+	unsigned long long v;
+	char *end;
+
+	errno = 0;
+	v = strtoull(s, &end, base);
+	if (end == s || (*end && !(*end == '\n' && !end[1])))
+		return -EINVAL;
+	if (errno || v > limit)
+		return -ERANGE;
+	*res = v;
+	return 0;
+}
+
+#define __kstrto(type, limit)						\
+static inline int kstrto##type(const char *s, unsigned int base, type *res) \
+{									\
+	u64 v;								\
+	int err = kstrtoull_base(s, base, &v, limit);			\
+									\
+	if (!err)							\
+		*res = v;						\
+	return err;							\
+}
+__kstrto(u16, UINT16_MAX)
+__kstrto(u32, UINT32_MAX)
+#undef __kstrto
+
+static inline int kstrtobool(const char *s, bool *res)
+{
+	switch (s[0]) {
+	case 'y': case 'Y': case '1':
+		*res = true;
+		return 0;
+	case 'n': case 'N': case '0':
+		*res = false;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+/* Atomics and bitops, single threaded */
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+
+static inline int atomic_read(const atomic_t *v) { return v->counter; }
+static inline void atomic_inc(atomic_t *v) { v->counter++; }
+static inline int atomic_xchg(atomic_t *v, int n) { int o = v->counter; v->counter = n; return o; }
+static inline s64 atomic64_read(const atomic64_t *v) { return v->counter; }
+static inline s64 atomic64_inc_return(atomic64_t *v) { return ++v->counter; }
+
+#define smp_wmb()			__atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb()			__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define xchg(p, v)			__atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define smp_store_release(p, v)		__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_load_acquire(p)		__atomic_load_n(p, __ATOMIC_ACQUIRE)
+
+#define DECLARE_BITMAP(name, bits)	unsigned long name[BITS_TO_LONGS(bits)]
+
+static inline void __set_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline void __clear_bit(long nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~(1UL << (nr % BITS_PER_LONG));
+}
+
+static inline bool test_bit(long nr, const unsigned long *addr)
+{
+	return addr[nr / BITS_PER_LONG] & (1UL << (nr % BITS_PER_LONG));
+}
+
+static inline bool test_and_set_bit(long nr, unsigned long *addr)
+{
+	bool old = test_bit(nr, addr);
+
+	__set_bit(nr, addr);
+	return old;
+}
+
+static inline bool test_and_clear_bit(long nr, unsigned long *addr)
+{
+	bool old = test_bit(nr, addr);
+
+	__clear_bit(nr, addr);
+	return old;
+}
+
+#define set_bit(nr, addr)		__set_bit(nr, addr)
+#define clear_bit(nr, addr)		__clear_bit(nr, addr)
+#define for_each_set_bit(bit, addr, size)				\
+	for ((bit) = 0; (bit) < (size); (bit)++)			\
+		if (test_bit(bit, addr))
+
+/* Lists */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *entry,
+				 struct list_head *head)
+{
+	entry->next = head;
+	entry->prev = head->prev;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry_or_null(head, type, member)			\
+	((head)->next != (head) ? list_entry((head)->next, type, member) : NULL)
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_entry((head)->next, __typeof__(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+/* Locking and RCU, no-ops without concurrency */
+
+typedef struct { int unused; } spinlock_t;
+struct mutex { int unused; };
+
+static inline void spin_lock_init(spinlock_t *lock) { }
+static inline void spin_lock(spinlock_t *lock) { }
+static inline void spin_unlock(spinlock_t *lock) { }
+#define spin_lock_irqsave(lock, flags)		((flags) = 0, spin_lock(lock))
+#define spin_unlock_irqrestore(lock, flags)	((void)(flags), spin_unlock(lock))
+#define lockdep_is_held(lock)			((void)(lock), 1)
+
+#define DEFINE_MUTEX(name)			struct mutex name = { 0 }
+
+static inline void mutex_init(struct mutex *lock) { }
+static inline void mutex_lock(struct mutex *lock) { }
+static inline int mutex_lock_interruptible(struct mutex *lock) { return 0; }
+static inline void mutex_unlock(struct mutex *lock) { }
+
+struct rcu_head { void *next; };
+
+#define rcu_read_lock()				do { } while (0)
+#define rcu_read_unlock()			do { } while (0)
+#define synchronize_rcu()			do { } while (0)
+#define rcu_dereference(p)			READ_ONCE(p)
+#define rcu_dereference_protected(p, c)		(p)
+#define rcu_access_pointer(p)			READ_ONCE(p)
+#define rcu_assign_pointer(p, v)		smp_store_release(&(p), v)
+#define RCU_INIT_POINTER(p, v)			WRITE_ONCE(p, v)
+#define rcu_replace_pointer(p, v, c)					\
+({									\
+	__typeof__(p) __old = (p);					\
+	rcu_assign_pointer(p, v);					\
+	__old;								\
+})
+
+/* Notifier chains */
+
+#define NOTIFY_DONE			0x0000
+
+struct notifier_block {
+	int (*notifier_call)(struct notifier_block *nb, unsigned long action,
+			     void *data);
+	struct notifier_block *next;
+	int priority;
+};
+
+struct atomic_notifier_head {
+	struct notifier_block *head;
+};
+
+#define ATOMIC_NOTIFIER_HEAD(name)	struct atomic_notifier_head name = { NULL }
+
+static inline int
+atomic_notifier_chain_register(struct atomic_notifier_head *nh,
+			       struct notifier_block *nb)
+{
+	nb->next = nh->head;
+	nh->head = nb;
+	return 0;
+}
+
+static inline int
+atomic_notifier_chain_unregister(struct atomic_notifier_head *nh,
+				 struct notifier_block *nb)
+{
+	struct notifier_block **p;
+
+	for (p = &nh->head; *p; p = &(*p)->next) {
+		if (*p == nb) {
+			*p = nb->next;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+static inline int atomic_notifier_call_chain(struct atomic_notifier_head *nh,
+					     unsigned long action, void *data)
+{
+	struct notifier_block *nb;
+	int ret = NOTIFY_DONE;
+
+	for (nb = nh->head; nb; nb = nb->next)
+		ret = nb->notifier_call(nb, action, data);
+	return ret;
+}
+
+/* Static keys */
+
+struct static_key_false { bool enabled; };
+
+#define DEFINE_STATIC_KEY_FALSE(name)	struct static_key_false name = { false }
+#define static_branch_unlikely(k)	unlikely((k)->enabled)
+#define static_key_enabled(k)		((k)->enabled)
+#define static_branch_enable(k)		((k)->enabled = true)
+#define static_branch_disable(k)	((k)->enabled = false)
+
+/* Per-CPU data, there is only CPU 0 */
+
+#define alloc_percpu(type)		((type *)calloc(1, sizeof(type)))
+#define free_percpu(p)			free(p)
+#define per_cpu_ptr(p, cpu)		((void)(cpu), (p))
+#define get_cpu_ptr(p)			(p)
+#define put_cpu_ptr(p)			((void)(p))
+#define this_cpu_inc(x)			((x)++)
+#define this_cpu_add(x, v)		((x) += (v))
+#define DEFINE_PER_CPU(type, name)	__typeof__(type) name
+#define this_cpu_write(x, v)		((x) = (v))
+#define __this_cpu_write(x, v)		((x) = (v))
+#define raw_cpu_read(x)			(x)
+#define preempt_disable()		do { } while (0)
+#define preempt_enable()		do { } while (0)
+#define WARN_ON_ONCE(cond)		({ bool __c = (cond); if (__c) abort(); __c; })
+#define for_each_possible_cpu(cpu)	for ((cpu) = 0; (cpu) < 1; (cpu)++)
+
+/* Time */
+
+typedef s64 ktime_t;
+
+#define HZ			1000
+#define NSEC_PER_USEC		1000ULL
+#define NSEC_PER_MSEC		1000000ULL
+#define NSEC_PER_SEC		1000000000ULL
+
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#define ktime_get()			((ktime_t)ktime_get_ns())
+#define jiffies				((unsigned long)(ktime_get_ns() / (NSEC_PER_SEC / HZ)))
+#define jiffies_to_msecs(j)		((unsigned int)((j) * 1000 / HZ))
+#define time_after(a, b)		((long)((b) - (a)) < 0)
+#define ktime_get_mono_fast_ns()	ktime_get_ns()
+#define ktime_sub(a, b)			((a) - (b))
+#define ktime_to_ns(t)			(t)
+#define ktime_us_delta(a, b)		(((a) - (b)) / 1000)
+#define ms_to_ktime(ms)			((ktime_t)(ms) * 1000000)
+
+/* hrtimers never fire, long_press_ms stays 0 */
+
+enum hrtimer_restart { HRTIMER_NORESTART, HRTIMER_RESTART };
+enum hrtimer_mode { HRTIMER_MODE_REL_SOFT };
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+	bool queued;
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	timer->function = function;
+}
+#else
+static inline void hrtimer_init(struct hrtimer *timer, clockid_t clock_id,
+				enum hrtimer_mode mode) { }
+#endif
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t tim,
+				 enum hrtimer_mode mode)
+{
+	timer->queued = true;
+}
+
+static inline int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	bool queued = timer->queued;
+
+	timer->queued = false;
+	return queued;
+}
+
+#define hrtimer_cancel(timer)		hrtimer_try_to_cancel(timer)
+
+static inline void fsleep(unsigned long usecs)
+{
+	struct timespec ts = {
+		.tv_sec = usecs / 1000000,
+		.tv_nsec = (usecs % 1000000) * 1000,
+	};
+
+	nanosleep(&ts, NULL);
+}
+
+#define cond_resched()			do { } while (0)
+#define current				NULL
+#define signal_pending(task)		((void)(task), 0)
+
+/* Logging */
+
+struct ratelimit_state {
+	int interval;
+	int burst;
+	u64 begin_ns;
+	int printed;
+};
+
+#define RATELIMIT_MSG_ON_RELEASE	1
+
+static inline void ratelimit_state_init(struct ratelimit_state *rs,
+					int interval, int burst)
+{
+	memset(rs, 0, sizeof(*rs));
+	rs->interval = interval;
+	rs->burst = burst;
+}
+
+#define ratelimit_set_flags(rs, flags)	((void)(rs), (void)(flags))
+
+static inline int __ratelimit(struct ratelimit_state *rs)
+{
+	u64 now = ktime_get_ns();
+
+	if (!rs->begin_ns ||
+	    now - rs->begin_ns >= (u64)rs->interval * (NSEC_PER_SEC / HZ)) {
+		rs->begin_ns = now;
+		rs->printed = 0;
+	}
+
+	return rs->printed++ < rs->burst;
+}
+
+/* Devices, devres is released by bench_devres_release() */
+
+struct kobject {
+	int unused;
+};
+
+struct device {
+	struct kobject kobj;
+	struct device *parent;
+	const char *name;
+	void *driver_data;
+};
+
+#define dev_name(dev)			((dev)->name)
+#define dev_set_drvdata(dev, data)	((dev)->driver_data = (data))
+#define dev_get_drvdata(dev)		((dev)->driver_data)
+#define dev_printk(dev, fmt, ...)	fprintf(stderr, "%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#define dev_err(dev, fmt, ...)		dev_printk(dev, fmt, ##__VA_ARGS__)
+#define dev_warn(dev, fmt, ...)		dev_printk(dev, fmt, ##__VA_ARGS__)
+#define dev_info(dev, fmt, ...)		dev_printk(dev, fmt, ##__VA_ARGS__)
+/* Like no_printk(), keeps the arguments referenced */
+#define dev_dbg(dev, fmt, ...)		\
+	((void)(dev), (void)sizeof(printf(fmt, ##__VA_ARGS__)))
+
+#define BENCH_MAX_DEVRES		16
+
+static void *bench_devres[BENCH_MAX_DEVRES];
+static unsigned int bench_nr_devres;
+
+static inline void *bench_devres_add(void *p)
+{
+	if (p && bench_nr_devres == BENCH_MAX_DEVRES)
+		abort();
+	if (p)
+		bench_devres[bench_nr_devres++] = p;
+	return p;
+}
+
+static inline void bench_devres_release(void)
+{
+	while (bench_nr_devres)
+		free(bench_devres[--bench_nr_devres]);
+}
+
+#define devm_kzalloc(dev, size, gfp)		bench_devres_add(calloc(1, size))
+#define devm_kcalloc(dev, n, size, gfp)		bench_devres_add(calloc(n, size))
+#define devm_alloc_percpu(dev, type)		((type *)bench_devres_add(calloc(1, sizeof(type))))
+
+#define PROBE_PREFER_ASYNCHRONOUS	1
+
+struct dev_pm_ops {
+	int (*suspend)(struct device *dev);
+	int (*resume)(struct device *dev);
+};
+
+#define DEFINE_SIMPLE_DEV_PM_OPS(name, suspend_fn, resume_fn)		\
+	const struct dev_pm_ops name = {				\
+		.suspend = suspend_fn,					\
+		.resume = resume_fn,					\
+	}
+#define pm_sleep_ptr(ptr)		(ptr)
+
+enum dpm_order {
+	DPM_ORDER_NONE,
+	DPM_ORDER_DEV_AFTER_PARENT,
+	DPM_ORDER_PARENT_BEFORE_DEV,
+	DPM_ORDER_DEV_LAST,
+};
+
+static inline int device_move(struct device *dev, struct device *new_parent,
+			      enum dpm_order dpm_order)
+{
+	dev->parent = new_parent;
+	return 0;
+}
+
+static inline int device_init_wakeup(struct device *dev, bool enable) { return 0; }
+static inline void pm_wakeup_hard_event(struct device *dev) { }
+
+struct device_driver {
+	const char *name;
+	const struct attribute_group **dev_groups;
+	const struct dev_pm_ops *pm;
+	int probe_type;
+};
+
+/* sysfs, debugfs and seq_file, never called by the benchmarks */
+
+#define PAGE_SIZE			4096
+
+struct attribute {
+	const char *name;
+	umode_t mode;
+};
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr,
+			char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t count);
+};
+
+struct attribute_group {
+	struct attribute **attrs;
+};
+
+#define DEVICE_ATTR_RO(_name)						\
+	struct device_attribute dev_attr_##_name = {			\
+		.attr = { .name = #_name, .mode = 0444 },		\
+		.show = _name##_show,					\
+	}
+#define DEVICE_ATTR_RW(_name)						\
+	struct device_attribute dev_attr_##_name = {			\
+		.attr = { .name = #_name, .mode = 0644 },		\
+		.show = _name##_show,					\
+		.store = _name##_store,					\
+	}
+#define ATTRIBUTE_GROUPS(_name)						\
+	static const struct attribute_group _name##_group = {		\
+		.attrs = _name##_attrs,					\
+	};								\
+	static const struct attribute_group *_name##_groups[] = {	\
+		&_name##_group, NULL,					\
+	}
+
+static inline int sysfs_emit_at(char *buf, int at, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf + at, PAGE_SIZE - at, fmt, args);
+	va_end(args);
+	return min(len, (int)PAGE_SIZE - at - 1);
+}
+
+#define sysfs_emit(buf, fmt, ...)	sysfs_emit_at(buf, 0, fmt, ##__VA_ARGS__)
+
+static inline void sysfs_notify(struct kobject *kobj, const char *dir,
+				const char *attr) { }
+
+struct dentry;
+struct module;
+struct poll_table_struct;
+struct vm_area_struct;
+
+typedef unsigned int __poll_t;
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	void *private_data;
+	unsigned int f_flags;
+};
+
+struct seq_file {
+	void *private;
+};
+
+struct file_operations {
+	struct module *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	ssize_t (*read)(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos);
+	ssize_t (*write)(struct file *file, const char __user *buf,
+			 size_t count, loff_t *ppos);
+	loff_t (*llseek)(struct file *file, loff_t offset, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+	__poll_t (*poll)(struct file *file, struct poll_table_struct *wait);
+	int (*mmap)(struct file *file, struct vm_area_struct *vma);
+};
+
+#define THIS_MODULE			NULL
+
+static inline struct dentry *debugfs_create_dir(const char *name,
+						struct dentry *parent)
+{
+	return NULL;
+}
+
+static inline struct dentry *
+debugfs_create_file(const char *name, umode_t mode, struct dentry *parent,
+		    void *data, const struct file_operations *fops)
+{
+	return NULL;
+}
+
+static inline void debugfs_remove_recursive(struct dentry *dentry) { }
+
+static inline int seq_printf(struct seq_file *m, const char *fmt, ...) { return 0; }
+
+static inline int single_open(struct file *file,
+			      int (*show)(struct seq_file *, void *), void *data)
+{
+	return -ENODEV;
+}
+
+static inline int single_release(struct inode *inode, struct file *file) { return 0; }
+static inline int simple_open(struct inode *inode, struct file *file) { return 0; }
+static inline ssize_t seq_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos) { return 0; }
+static inline loff_t seq_lseek(struct file *file, loff_t offset, int whence) { return 0; }
+static inline loff_t default_llseek(struct file *file, loff_t offset, int whence) { return 0; }
+static inline loff_t noop_llseek(struct file *file, loff_t offset, int whence) { return 0; }
+
+#define DEFINE_SHOW_ATTRIBUTE(name)					\
+static int name##_open(struct inode *inode, struct file *file)		\
+{									\
+	return single_open(file, name##_show, inode->i_private);	\
+}									\
+static const struct file_operations name##_fops = {			\
+	.open = name##_open,						\
+	.read = seq_read,						\
+	.llseek = seq_lseek,						\
+	.release = single_release,					\
+}
+
+/* Misc device and event ring, only set up with event_ring */
+
+#ifndef O_NONBLOCK
+#define O_NONBLOCK			04000
+#endif
+
+#define EPOLLIN				0x0001
+#define EPOLLRDNORM			0x0040
+#define EPOLLHUP			0x0010
+
+#define MISC_DYNAMIC_MINOR		255
+
+#define VM_WRITE			0x0002
+#define VM_MAYWRITE			0x0020
+
+struct kref {
+	int refcount;
+};
+
+static inline void kref_init(struct kref *kref) { kref->refcount = 1; }
+static inline void kref_get(struct kref *kref) { kref->refcount++; }
+
+static inline int kref_put(struct kref *kref, void (*release)(struct kref *))
+{
+	if (--kref->refcount)
+		return 0;
+	release(kref);
+	return 1;
+}
+
+typedef struct { int unused; } wait_queue_head_t;
+typedef struct poll_table_struct poll_table;
+
+#define init_waitqueue_head(wq)			((void)(wq))
+#define wq_has_sleeper(wq)			false
+#define wake_up_interruptible_poll(wq, m)	((void)(wq))
+#define wait_event_interruptible(wq, cond)	((cond) ? 0 : -EINTR)
+
+static inline void poll_wait(struct file *file, wait_queue_head_t *wq,
+			     poll_table *wait) { }
+
+struct vm_area_struct {
+	unsigned long vm_flags;
+	unsigned long vm_pgoff;
+};
+
+static inline void vm_flags_clear(struct vm_area_struct *vma,
+				  unsigned long flags)
+{
+	vma->vm_flags &= ~flags;
+}
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+				      unsigned long pgoff)
+{
+	return -ENODEV;
+}
+
+static inline void *vmalloc_user(unsigned long size) { return calloc(1, size); }
+static inline void vfree(const void *p) { free((void *)p); }
+
+struct miscdevice {
+	int minor;
+	const char *name;
+	const struct file_operations *fops;
+	struct device *parent;
+	umode_t mode;
+	struct device *this_device;
+};
+
+static inline int misc_register(struct miscdevice *misc) { return 0; }
+static inline void misc_deregister(struct miscdevice *misc) { }
+
+/* Module glue */
+
+#define EXPORT_SYMBOL_GPL(sym)
+
+struct kernel_param {
+	void *arg;
+};
+
+struct kernel_param_ops {
+	int (*set)(const char *val, const struct kernel_param *kp);
+	int (*get)(char *buffer, const struct kernel_param *kp);
+};
+
+typedef char *charp;
+
+#define module_param(name, type, perm)
+#define module_param_cb(name, ops, arg, perm)				\
+	static const struct kernel_param_ops *__param_##name __attribute__((used)) = (ops)
+#define MODULE_PARM_DESC(name, desc)
+#define MODULE_DEVICE_TABLE(type, name)
+#define MODULE_AUTHOR(author)
+#define MODULE_DESCRIPTION(desc)
+#define MODULE_LICENSE(license)
+#define module_init(fn)	static int (*__module_init)(void) __attribute__((used)) = fn
+#define module_exit(fn)	static void (*__module_exit)(void) __attribute__((used)) = fn
+
+/* Work items run synchronously */
+
+struct work_struct {
+	void (*func)(struct work_struct *work);
+};
+
+struct workqueue_struct;
+
+#define system_unbound_wq		((struct workqueue_struct *)NULL)
+#define INIT_WORK(w, f)			((w)->func = (f))
+
+static inline bool queue_work(struct workqueue_struct *wq,
+			      struct work_struct *work)
+{
+	work->func(work);
+	return true;
+}
+
+#define schedule_work(work)		queue_work(system_unbound_wq, work)
+#define queue_work_on(cpu, wq, work)	((void)(cpu), queue_work(wq, work))
+
+#define WQ_HIGHPRI			0x10
+#define nr_cpu_ids			1U
+#define cpu_online(cpu)			((cpu) == 0)
+
+/* Only deferred_delivery allocates one, the handle is never dereferenced */
+static inline struct workqueue_struct *alloc_workqueue(const char *fmt,
+						       unsigned int flags,
+						       int max_active, ...)
+{
+	return (struct workqueue_struct *)1;
+}
+
+static inline void destroy_workqueue(struct workqueue_struct *wq) { }
+
+static inline bool cancel_work_sync(struct work_struct *work) { return false; }
+static inline bool flush_work(struct work_struct *work) { return false; }
+
+/* Delayed work only records that it is queued, it never runs */
+struct delayed_work {
+	struct work_struct work;
+	bool pending;
+};
+
+#define system_wq			((struct workqueue_struct *)NULL)
+#define INIT_DELAYED_WORK(w, f)		((w)->work.func = (f), (w)->pending = false)
+#define to_delayed_work(w)		container_of(w, struct delayed_work, work)
+
+static inline bool schedule_delayed_work(struct delayed_work *dwork,
+					 unsigned long delay)
+{
+	bool queued = !dwork->pending;
+
+	dwork->pending = true;
+	return queued;
+}
+
+#define mod_delayed_work(wq, dwork, delay)	schedule_delayed_work(dwork, delay)
+
+static inline bool flush_delayed_work(struct delayed_work *dwork)
+{
+	return dwork->pending;
+}
+
+static inline bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	bool pending = dwork->pending;
+
+	dwork->pending = false;
+	return pending;
+}
+
+/* kfifo, power of two sizes */
+
+#define DECLARE_KFIFO(name, type, size)					\
+	struct {							\
+		type buf[size];						\
+		unsigned int in, out;					\
+	} name
+#define INIT_KFIFO(fifo)		((fifo).in = (fifo).out = 0)
+#define kfifo_put(fifo, val)						\
+({									\
+	__typeof__(fifo) __f = (fifo);					\
+	bool __ok = __f->in - __f->out < ARRAY_SIZE(__f->buf);		\
+									\
+	if (__ok)							\
+		__f->buf[__f->in++ & (ARRAY_SIZE(__f->buf) - 1)] = (val); \
+	__ok;								\
+})
+#define kfifo_is_empty(fifo)		((fifo)->in == (fifo)->out)
+#define kfifo_in(fifo, from, n)						\
+({									\
+	__typeof__(fifo) __f = (fifo);					\
+	unsigned int __i, __n = min((unsigned int)(n),			\
+				    (unsigned int)ARRAY_SIZE(__f->buf) - \
+				    (__f->in - __f->out));		\
+									\
+	for (__i = 0; __i < __n; __i++)					\
+		__f->buf[__f->in++ & (ARRAY_SIZE(__f->buf) - 1)] = (from)[__i]; \
+	__n;								\
+})
+#define kfifo_out(fifo, to, n)						\
+({									\
+	__typeof__(fifo) __f = (fifo);					\
+	unsigned int __i, __n = min((unsigned int)(n), __f->in - __f->out); \
+									\
+	for (__i = 0; __i < __n; __i++)					\
+		(to)[__i] = __f->buf[__f->out++ & (ARRAY_SIZE(__f->buf) - 1)]; \
+	__n;								\
+})
+#define kfifo_get(fifo, val)						\
+({									\
+	__typeof__(fifo) __f = (fifo);					\
+	bool __ok = __f->in != __f->out;				\
+									\
+	if (__ok)							\
+		*(val) = __f->buf[__f->out++ & (ARRAY_SIZE(__f->buf) - 1)]; \
+	__ok;								\
+})
+
+/* DMI and firmware, no model and no firmware file */
+
+enum dmi_field {
+	DMI_SYS_VENDOR,
+	DMI_PRODUCT_VERSION,
+};
+
+struct dmi_strmatch {
+	enum dmi_field slot;
+	const char *substr;
+};
+
+struct dmi_system_id {
+	const char *ident;
+	struct dmi_strmatch matches[4];
+	void *driver_data;
+};
+
+#define DMI_MATCH(slot, str)		{ slot, str }
+#define dmi_first_match(list)		((const struct dmi_system_id *)NULL)
+
+struct firmware {
+	size_t size;
+	const u8 *data;
+};
+
+#define request_firmware_direct(fw, name, dev)	(-ENOENT)
+#define release_firmware(fw)			((void)(fw))
+
+/* ACPI and WMI */
+
+typedef u32 acpi_object_type;
+
+#define ACPI_TYPE_INTEGER		0x01
+#define ACPI_TYPE_BUFFER		0x03
+#define ACPI_TYPE_PACKAGE		0x04
+
+union acpi_object {
+	acpi_object_type type;
+	struct {
+		acpi_object_type type;
+		u64 value;
+	} integer;
+	struct {
+		acpi_object_type type;
+		u32 length;
+		u8 *pointer;
+	} buffer;
+	struct {
+		acpi_object_type type;
+		u32 count;
+		union acpi_object *elements;
+	} package;
+};
+
+struct wmi_device {
+	struct device dev;
+};
+
+struct wmi_buffer {
+	size_t length;
+	void *data;
+};
+
+struct wmi_device_id {
+	const char *guid_string;
+	const void *context;
+};
+
+struct wmi_driver {
+	struct device_driver driver;
+	const struct wmi_device_id *id_table;
+	int (*probe)(struct wmi_device *wdev, const void *context);
+	void (*remove)(struct wmi_device *wdev);
+	void (*notify)(struct wmi_device *wdev, union acpi_object *data);
+	size_t min_event_size;
+	void (*notify_new)(struct wmi_device *wdev,
+			   const struct wmi_buffer *data);
+};
+
+#define wmi_driver_register(drv)	((void)(drv), 0)
+#define wmi_driver_unregister(drv)	((void)(drv))
+
+/* Input core, events are only counted */
+
+#define BUS_HOST			0x19
+#define INPUT_KEYMAP_BY_INDEX		(1 << 0)
+
+struct input_id {
+	u16 bustype;
+};
+
+struct input_keymap_entry {
+	u8 flags;
+	u8 len;
+	u16 index;
+	u32 keycode;
+	u8 scancode[32];
+};
+
+struct input_dev {
+	const char *name;
+	const char *phys;
+	struct input_id id;
+	struct device dev;
+	unsigned long evbit[BITS_TO_LONGS(EV_CNT)];
+	unsigned long mscbit[BITS_TO_LONGS(MSC_CNT)];
+	unsigned long keybit[BITS_TO_LONGS(KEY_CNT)];
+	int (*getkeycode)(struct input_dev *dev, struct input_keymap_entry *ke);
+	int (*setkeycode)(struct input_dev *dev,
+			  const struct input_keymap_entry *ke,
+			  unsigned int *old_keycode);
+};
+
+/* Counters read by the benchmark harness */
+static u64 bench_input_events;
+static u64 bench_input_syncs;
+
+static inline struct input_dev *input_allocate_device(void)
+{
+	return calloc(1, sizeof(struct input_dev));
+}
+
+static inline void input_free_device(struct input_dev *dev) { free(dev); }
+static inline int input_register_device(struct input_dev *dev) { return 0; }
+static inline void input_unregister_device(struct input_dev *dev) { free(dev); }
+
+static inline void input_set_drvdata(struct input_dev *input_dev, void *data)
+{
+	input_dev->dev.driver_data = data;
+}
+
+static inline void *input_get_drvdata(struct input_dev *input_dev)
+{
+	return input_dev->dev.driver_data;
+}
+
+static inline void input_event(struct input_dev *dev, unsigned int type,
+			       unsigned int code, int value)
+{
+	if (type == EV_SYN)
+		bench_input_syncs++;
+	else
+		bench_input_events++;
+}
+
+#define input_report_key(dev, code, value)	input_event(dev, EV_KEY, code, !!(value))
+#define input_sync(dev)				input_event(dev, EV_SYN, SYN_REPORT, 0)
+
+static inline int input_scancode_to_scalar(const struct input_keymap_entry *ke,
+					   unsigned int *scancode)
+{
+	if (ke->len != sizeof(u32))
+		return -EINVAL;
+	memcpy(scancode, ke->scancode, sizeof(u32));
+	return 0;
+}
+
+enum { KE_END, KE_KEY, KE_SW, KE_VSW, KE_IGNORE };
+
+struct key_entry {
+	int type;
+	u32 code;
+	union {
+		u16 keycode;
+		struct {
+			u8 code;
+			u8 value;
+		} sw;
+	};
+};
+
+/* Tracepoints compile away */
+
+#define TP_PROTO(...)			__VA_ARGS__
+#define TP_ARGS(...)			__VA_ARGS__
+#define TRACE_DEFINE_ENUM(x)
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) { }
+
+#endif /* _IDEAPAD_WMI_BENCH_KERNEL_H */
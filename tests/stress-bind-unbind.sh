@@ -0,0 +1,65 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Repeatedly unbinds and rebinds ideapad-wmi-fn-keys while LOAD_CMD keeps
+# generating events, to catch races between the notify path and remove.
+# Best run on a kernel with KASAN and lockdep enabled.
+#
+# Usage: [LOAD_CMD="<command>"] stress-bind-unbind.sh [iterations]
+#
+# LOAD_CMD defaults to bursts from the debugfs event injector, which stays
+# live until the input device is unpublished and unregistered on unbind. It
+# needs CONFIG_DEBUG_FS and debugfs mounted, pass LOAD_CMD otherwise.
+
+DRIVER=/sys/bus/wmi/drivers/ideapad-wmi-fn-keys
+GUID=8FC0DE0C-B4E4-43FD-B0F3-8871711C1294
+ITERATIONS=${1:-1000}
+
+set -e
+
+if [ ! -d "$DRIVER" ]; then
+	echo "ideapad-wmi-fn-keys is not loaded" >&2
+	exit 1
+fi
+
+DEVICE=
+for dev in "$DRIVER"/"$GUID"*; do
+	[ -L "$dev" ] && DEVICE=$(basename "$dev") && break
+done
+
+if [ -z "$DEVICE" ]; then
+	echo "No WMI device bound to ideapad-wmi-fn-keys" >&2
+	exit 1
+fi
+
+# The debugfs root is named after KBUILD_MODNAME
+INJECT=/sys/kernel/debug/ideapad_wmi_fn_keys/$DEVICE/inject
+if [ -z "$LOAD_CMD" ]; then
+	if [ ! -e "$INJECT" ]; then
+		echo "$INJECT not found, mount debugfs or pass LOAD_CMD" >&2
+		exit 1
+	fi
+	LOAD_CMD="echo '0x12 100' > $INJECT"
+fi
+
+# Keeps writing through every teardown, failures while unbound are expected
+(while :; do sh -c "$LOAD_CMD" >/dev/null 2>&1 || true; done) &
+LOAD_PID=$!
+
+trap 'kill "$LOAD_PID" 2>/dev/null; echo "$DEVICE" > "$DRIVER/bind" 2>/dev/null || true' EXIT
+
+dmesg_before=$(dmesg | wc -l)
+
+i=0
+while [ "$i" -lt "$ITERATIONS" ]; do
+	echo "$DEVICE" > "$DRIVER/unbind"
+	echo "$DEVICE" > "$DRIVER/bind"
+	i=$((i + 1))
+done
+
+if dmesg | tail -n +"$((dmesg_before + 1))" | grep -E "BUG|WARNING|KASAN|circular locking"; then
+	echo "FAIL: kernel reported problems during $ITERATIONS iterations" >&2
+	exit 1
+fi
+
+echo "PASS: $ITERATIONS bind/unbind iterations"
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Tracepoints for the Ideapad WMI fn keys driver
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ideapad_wmi
+
+#if !defined(_IDEAPAD_WMI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _IDEAPAD_WMI_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#define IDEAPAD_WMI_DROP_REASONS		\
+	EM(NOT_INTEGER,	not_integer)		\
+	EM(IGNORED,	ignored)		\
+	EM(DEBOUNCED,	debounced)		\
+	EM(OVERFLOW,	overflow)		\
+	EM(FILTERED,	filtered)		\
+	EM(SUSPENDED,	suspended)		\
+	EM(NOT_READY,	not_ready)		\
+	EMe(LONG_PRESS,	long_press)
+
+#ifndef _IDEAPAD_WMI_DROP_REASON_ENUM
+#define _IDEAPAD_WMI_DROP_REASON_ENUM
+
+#undef EM
+#undef EMe
+#define EM(a, b)	IDEAPAD_WMI_DROP_##a,
+#define EMe(a, b)	IDEAPAD_WMI_DROP_##a
+
+enum ideapad_wmi_drop_reason {
+	IDEAPAD_WMI_DROP_REASONS
+};
+
+#endif
+
+#undef EM
+#undef EMe
+#define EM(a, b)	TRACE_DEFINE_ENUM(IDEAPAD_WMI_DROP_##a);
+#define EMe(a, b)	TRACE_DEFINE_ENUM(IDEAPAD_WMI_DROP_##a);
+
+IDEAPAD_WMI_DROP_REASONS
+
+#undef EM
+#undef EMe
+#define EM(a, b)	{ IDEAPAD_WMI_DROP_##a, #b },
+#define EMe(a, b)	{ IDEAPAD_WMI_DROP_##a, #b }
+
+/*
+ * value is the integer for ACPI_TYPE_INTEGER events, the element count for
+ * packages and the length for buffers.
+ */
+TRACE_EVENT(ideapad_wmi_notify,
+
+	TP_PROTO(u32 type, u64 value),
+
+	TP_ARGS(type, value),
+
+	TP_STRUCT__entry(
+		__field(u32, type)
+		__field(u64, value)
+	),
+
+	TP_fast_assign(
+		__entry->type = type;
+		__entry->value = value;
+	),
+
+	TP_printk("type=%u value=%#llx", __entry->type, __entry->value)
+);
+
+TRACE_EVENT(ideapad_wmi_report,
+
+	TP_PROTO(unsigned int scancode, unsigned int keycode),
+
+	TP_ARGS(scancode, keycode),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, scancode)
+		__field(unsigned int, keycode)
+	),
+
+	TP_fast_assign(
+		__entry->scancode = scancode;
+		__entry->keycode = keycode;
+	),
+
+	TP_printk("scancode=%#x keycode=%u", __entry->scancode,
+		  __entry->keycode)
+);
+
+TRACE_EVENT(ideapad_wmi_drop,
+
+	TP_PROTO(unsigned int scancode, enum ideapad_wmi_drop_reason reason),
+
+	TP_ARGS(scancode, reason),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, scancode)
+		__field(unsigned int, reason)
+	),
+
+	TP_fast_assign(
+		__entry->scancode = scancode;
+		__entry->reason = reason;
+	),
+
+	TP_printk("scancode=%#x reason=%s", __entry->scancode,
+		  __print_symbolic(__entry->reason, IDEAPAD_WMI_DROP_REASONS))
+);
+
+#endif /* _IDEAPAD_WMI_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>